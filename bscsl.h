@@ -0,0 +1,176 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup bscsl SPI/I2C Slave (BSCSL)
+ *
+ * These functions operate the native BSC/SPI slave peripheral, which is
+ * connected to GPIO18-21 on boards with the 40-pin header.  Unlike the PCM
+ * based SPI slave in `spisl.h`, it is byte aligned by chip select (SPI) or by
+ * the start condition (I2C), so no synchronization is required.
+ *
+ * Both FIFOs hold @ref raspi_BSCSL_FIFOSIZE bytes.  Reads and writes are
+ * non-blocking and transfer as many bytes as the FIFO levels allow, based on a
+ * single flag register read per burst.
+ *
+ * Declared in `bscsl.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_BSCSL_H
+#define RASPI_DIRECTHW_BSCSL_H
+
+#include "hw.h"
+
+/// Size of both, the read and the write FIFO.
+#define raspi_BSCSL_FIFOSIZE 16
+
+/// Receive FIFO overrun flag returned by bscsl_errors().
+#define BSCSL_ERROR_OVERRUN 1
+/// Transmit FIFO underrun flag returned by bscsl_errors().
+#define BSCSL_ERROR_UNDERRUN 2
+
+
+/// Reset the slave, clear both FIFOs and enable it with the mode bits in _cr_.
+static inline void bscsl_start(struct raspi_BSCSL_CR_reg cr)
+{
+	const struct raspi_BSCSL_CR_reg brk = {
+		.BRK = 1,
+	};
+
+	HW.BSCSL.CR.U = 0;
+	HW.BSCSL.CR.B = brk;
+	HW.BSCSL.CR.U = 0;
+	HW.BSCSL.RSR.U = 0;
+
+	cr.EN = 1;
+	cr.TXE = 1;
+	cr.RXE = 1;
+	HW.BSCSL.CR.B = cr;
+	memory_barrier();
+}
+
+
+/// Configure the slave for SPI mode 0-3 as given by _cpol_ and _cpha_.
+static inline void bscsl_init_spi(int cpol, int cpha)
+{
+	struct raspi_BSCSL_CR_reg cr = {
+		.SPI = 1,
+	};
+
+	cr.CPOL = !!cpol;
+	cr.CPHA = !!cpha;
+
+	gpio_configure_mask(0, 0xfu << 18, Alt3, PullOff);
+	memory_barrier();
+	bscsl_start(cr);
+}
+
+
+/// Configure the slave for I2C with 7 bit address _addr_.  SDA and SCL need
+/// external pull-up resistors.
+static inline void bscsl_init_i2c(uint8_t addr)
+{
+	const struct raspi_BSCSL_CR_reg cr = {
+		.I2C = 1,
+	};
+
+	gpio_configure_mask(0, 0x3u << 18, Alt3, PullOff);
+	memory_barrier();
+	HW.BSCSL.SLV = addr & 0x7f;
+	bscsl_start(cr);
+}
+
+
+/// Return the number of bytes in the receive FIFO.
+static inline uint32_t bscsl_available(void)
+{
+	return HW.BSCSL.FR.B.RXFLEVEL;
+}
+
+
+/// Copy up to _max_ received bytes into _buf_ and return the number of bytes
+/// copied.  Never blocks.
+static inline uint32_t bscsl_read_buf(uint8_t *buf, uint32_t max)
+{
+	uint32_t num = 0;
+
+	while (num < max) {
+		uint32_t level = HW.BSCSL.FR.B.RXFLEVEL;
+		if (!level) break;
+		if (level > max - num) level = max - num;
+
+		// the upper bits of DR hold flags, which are not needed here
+		for (; level; level--) buf[num++] = HW.BSCSL.DR.U;
+	}
+
+	return num;
+}
+
+
+/// Queue up to _len_ bytes from _buf_ for transmission and return the number
+/// of bytes queued.  Never blocks.  The master receives them in later
+/// transfers.
+static inline uint32_t bscsl_write_buf(const uint8_t *buf, uint32_t len)
+{
+	uint32_t num = 0;
+
+	while (num < len) {
+		uint32_t space = raspi_BSCSL_FIFOSIZE - HW.BSCSL.FR.B.TXFLEVEL;
+		if (!space) break;
+		if (space > len - num) space = len - num;
+
+		for (; space; space--) HW.BSCSL.DR.U = buf[num++];
+	}
+
+	return num;
+}
+
+
+/// Block until the transmit FIFO is empty.
+static inline void bscsl_flush(void)
+{
+	while (!HW.BSCSL.FR.B.TXFE);
+}
+
+
+/// Return the error flags accumulated since the last call, a combination of
+/// @ref BSCSL_ERROR_OVERRUN and @ref BSCSL_ERROR_UNDERRUN, and clear them.
+static inline uint32_t bscsl_errors(void)
+{
+	uint32_t rsr = HW.BSCSL.RSR.U & (BSCSL_ERROR_OVERRUN | BSCSL_ERROR_UNDERRUN);
+	HW.BSCSL.RSR.U = 0;
+	return rsr;
+}
+
+
+/// Disable the slave and release the bus.
+static inline void bscsl_stop(void)
+{
+	HW.BSCSL.CR.U = 0;
+	memory_barrier();
+}
+
+#endif
+
+///@}
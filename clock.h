@@ -0,0 +1,209 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup clock Clock Manager
+ *
+ * These functions run the clock manager entries of the GPCLK outputs and of
+ * peripherals like PCM and PWM at a requested frequency.  clock_set() picks
+ * the source and divider that come closest to the request, switches the clock
+ * without glitches and returns the frequency actually achieved.
+ *
+ * Dividers have 12 integer and 12 fractional bits.  With MASH level 0, only
+ * the integer part is used, giving a clean clock at a coarse frequency
+ * resolution.  Levels 1-3 toggle between neighboring integer dividers to hit
+ * the fractional part on average.  This is precise on average but adds jitter,
+ * and the higher levels spread it over more neighbors.
+ *
+ *   Clock  | Pins
+ *  --------|-----------------------------------------------------
+ *   GPCLK0 | GPIO4 Alt0, GPIO20 Alt5, GPIO32 Alt0, GPIO34 Alt0
+ *   GPCLK1 | GPIO5 Alt0, GPIO21 Alt5, GPIO42 Alt0, GPIO44 Alt0
+ *   GPCLK2 | GPIO6 Alt0, GPIO43 Alt0
+ *
+ * Declared in `clock.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_CLOCK_H
+#define RASPI_DIRECTHW_CLOCK_H
+
+#include "hw.h"
+
+/// Frequency in Hz of the crystal oscillator.  This is correct for Pi 1-3.
+#define CLOCK_OSC_FREQ 19200000
+
+/// Frequency in Hz of PLLD.  This is correct for Pi 1-3.
+#define CLOCK_PLLD_FREQ 500000000
+
+/// Largest integer divider.
+#define CLOCK_DIVI_MAX 4095
+
+
+/// Return the frequency in Hz of clock source _src_, or 0 for sources whose
+/// frequency is not fixed.
+static inline uint32_t clock_source_freq(raspi_CM_CTL_SRC_t src)
+{
+	switch (src) {
+	case CM_OSC: return CLOCK_OSC_FREQ;
+	case CM_PLLD: return CLOCK_PLLD_FREQ;
+	default: return 0;
+	}
+}
+
+
+/// Return the smallest integer divider usable with MASH level _mash_.
+static inline uint32_t clock_divi_min(int mash)
+{
+	static const uint8_t min[4] = { 1, 2, 3, 5 };
+	return min[mash & 3];
+}
+
+
+/// Stop clock manager entry _cm_ and block until it has stopped.  The source
+/// is kept, so the output does not glitch.
+static inline void clock_stop(raspi_CM_reg_t cm)
+{
+	struct raspi_CM_CTL_reg ctl = {
+		.PASSWD = CM_PASSWD,
+	};
+
+	ctl.SRC = HW.CM[cm].CTL.B.SRC;
+	ctl.MASH = HW.CM[cm].CTL.B.MASH;
+
+	HW.CM[cm].CTL.B = ctl;
+	while (HW.CM[cm].CTL.B.BUSY);
+	memory_barrier();
+}
+
+
+/// Stop clock manager entry _cm_, then restart it from source _src_ divided by
+/// _divi_ + _divf_ / 4096 with MASH level _mash_.  Source and divider are only
+/// changed while the clock is stopped, as required by the datasheet.
+static inline void clock_start(raspi_CM_reg_t cm, raspi_CM_CTL_SRC_t src, uint32_t divi, uint32_t divf, int mash)
+{
+	struct raspi_CM_CTL_reg ctl = {
+		.PASSWD = CM_PASSWD,
+	};
+	struct raspi_CM_DIV_reg div = {
+		.PASSWD = CM_PASSWD,
+	};
+
+	clock_stop(cm);
+
+	div.DIVI = divi;
+	div.DIVF = divf;
+	ctl.SRC = src;
+	ctl.MASH = mash;
+
+	HW.CM[cm].DIV.B = div;
+	HW.CM[cm].CTL.B = ctl;
+	ctl.ENAB = 1;
+	HW.CM[cm].CTL.B = ctl;
+	memory_barrier();
+}
+
+
+/// Compute the divider for _freq_ Hz from a source of _source_ Hz in 12.12
+/// fixed point, with the fractional part dropped for MASH level 0.  Return 0
+/// if the divider is out of range.
+static inline uint32_t clock_divider(uint32_t source, uint32_t freq, int mash)
+{
+	uint64_t div;
+
+	if (!source || !freq) return 0;
+	if (mash) div = ((uint64_t)source * 4096 + freq/2) / freq;
+	else div = ((uint64_t)source + freq/2) / freq * 4096;
+
+	if (div < clock_divi_min(mash) * 4096u || div >= (CLOCK_DIVI_MAX + 1) * 4096u) return 0;
+	return div;
+}
+
+
+/// Run clock manager entry _cm_ at _freq_ Hz with MASH level _mash_ (0-3),
+/// using the source that comes closest.  Return the average frequency
+/// actually achieved, or 0 if _freq_ cannot be reached.  The clock keeps
+/// running unchanged in that case.
+static inline uint32_t clock_set(raspi_CM_reg_t cm, uint32_t freq, int mash)
+{
+	static const raspi_CM_CTL_SRC_t sources[] = { CM_OSC, CM_PLLD };
+	raspi_CM_CTL_SRC_t best_src = CM_GND;
+	uint32_t best_div = 0;
+	uint32_t best = 0;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+		uint32_t source = clock_source_freq(sources[i]);
+		uint32_t div = clock_divider(source, freq, mash);
+		uint32_t achieved;
+
+		if (!div) continue;
+		achieved = ((uint64_t)source * 4096 + div/2) / div;
+
+		// on a tie, keep the slower source, which has less jitter
+		if (!best || (achieved > freq ? achieved - freq : freq - achieved) < (best > freq ? best - freq : freq - best)) {
+			best = achieved;
+			best_div = div;
+			best_src = sources[i];
+		}
+	}
+
+	if (!best) return 0;
+	clock_start(cm, best_src, best_div >> 12, best_div & 0xfff, mash);
+	return best;
+}
+
+
+/// Return the general purpose clock (0-2) available on _gpio_, or -1 if none.
+static inline int clock_gpclk_of(int gpio)
+{
+	switch (gpio) {
+	case 4: case 20: case 32: case 34: return 0;
+	case 5: case 21: case 42: case 44: return 1;
+	case 6: case 43: return 2;
+	default: return -1;
+	}
+}
+
+
+/// Output _freq_ Hz with MASH level _mash_ on _gpio_, using the general
+/// purpose clock mapped to it.  Return the frequency achieved as for
+/// clock_set(), or 0 if _gpio_ has no GPCLK function.
+static inline uint32_t clock_output(int gpio, uint32_t freq, int mash)
+{
+	int gpclk = clock_gpclk_of(gpio);
+	uint32_t achieved;
+
+	if (gpclk < 0) return 0;
+	achieved = clock_set((raspi_CM_reg_t)(CM_GP0 + gpclk), freq, mash);
+	if (!achieved) return 0;
+
+	memory_barrier();
+	gpio_configure(gpio, gpio == 20 || gpio == 21 ? Alt5 : Alt0, PullOff);
+	memory_barrier();
+	return achieved;
+}
+
+#endif
+
+///@}
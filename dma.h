@@ -0,0 +1,310 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup dma DMA Controller
+ *
+ * These functions start and monitor transfers on the DMA controller's channels
+ * 0-15.  Control blocks and buffers must reside in DMA-visible memory, see
+ * @ref memory.  All addresses written to a @ref raspi_dma_control_block are
+ * bus addresses, use `MEM_BUS()` and `HW_BUS()` to obtain them.
+ *
+ * Either the caller selects the channel number, or dma_channel_alloc() finds
+ * one that is not used by the firmware or the kernel, based on the
+ * `brcm,dma-channel-mask` property in `/proc/device-tree/soc/dma@7e007000/`.
+ * Channels 7-14 are "lite" channels with reduced bandwidth, a maximum of 65536
+ * bytes per control block, and no 2D mode.  On the Pi 4, channels 11-14 have a
+ * different register layout and are not supported.
+ *
+ * Control blocks may be taken from a @ref dma_pool_t, and linked with
+ * dma_chain().
+ *
+ * Declared in `dma.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_DMA_H
+#define RASPI_DIRECTHW_DMA_H
+
+#include "hw.h"
+
+
+/// Return the registers of DMA channel _ch_ (0-15).
+static inline volatile raspi_DMA15_regs *dma_channel(int ch)
+{
+	if (ch == 15) return &HW.DMA15;
+	return &HW.DMA[ch];
+}
+
+
+/// Fill in control block _cb_.  _next_ is the bus address of the following
+/// control block, or 0 to end the transfer after this one.
+static inline void dma_cb_set(volatile raspi_dma_control_block *cb,
+		struct raspi_DMA_TI_reg ti, uint32_t source, uint32_t dest,
+		uint32_t len, uint32_t next)
+{
+	cb->TI.B = ti;
+	cb->SOURCE_AD = source;
+	cb->DEST_AD = dest;
+	cb->TXFR_LEN = len;
+	cb->STRIDE = 0;
+	cb->NEXTCONBK = next;
+	cb->DEBUG = 0;
+	cb->reserved_0x1c = 0;
+}
+
+
+/// Fill in control block _cb_ for a 2D transfer of _ylen_ rows of _xlen_ bytes
+/// each.  After each row, _src_stride_ and _dest_stride_ bytes are added to the
+/// source and destination addresses, in addition to the increments requested in
+/// _ti_.  Only supported by channels 0-6.  Return false if a length is out of
+/// range.
+static inline int dma_cb_set_2d(volatile raspi_dma_control_block *cb,
+		struct raspi_DMA_TI_reg ti, uint32_t source, uint32_t dest,
+		uint32_t xlen, uint32_t ylen, int16_t src_stride, int16_t dest_stride,
+		uint32_t next)
+{
+	if (!xlen || xlen > 0xffff || !ylen || ylen > 0x3fff) return 0;
+
+	ti.TDMODE = 1;
+	dma_cb_set(cb, ti, source, dest, ylen << 16 | xlen, next);
+	cb->STRIDE = (uint32_t)(uint16_t)dest_stride << 16 | (uint16_t)src_stride;
+	return 1;
+}
+
+
+/// Link the _num_ control blocks in _mem_ starting at _cb_ in order.  If
+/// _loop_ is true, the last one links back to the first, otherwise it ends the
+/// transfer.
+static inline void dma_chain(const raspi_mem_t *mem, volatile raspi_dma_control_block *cb, uint32_t num, int loop)
+{
+	uint32_t i;
+
+	for (i = 0; i + 1 < num; i++) cb[i].NEXTCONBK = MEM_BUS(mem, &cb[i + 1]);
+	if (num) cb[num - 1].NEXTCONBK = loop ? MEM_BUS(mem, cb) : 0;
+}
+
+
+/// Enable and reset DMA channel _ch_.  Any running transfer is aborted.
+static inline void dma_reset(int ch)
+{
+	volatile raspi_DMA15_regs *dma = dma_channel(ch);
+	const struct raspi_DMA_CS_reg reset = {
+		.RESET = 1,
+	};
+
+	if (ch < 15) HW.DMA_GLOBAL.ENABLE |= 1 << ch;
+	memory_barrier();
+	dma->CS.B = reset;
+	while (dma->CS.B.RESET);
+	memory_barrier();
+}
+
+
+/// Start DMA channel _ch_ with the control block at bus address _cb_.
+static inline void dma_start(int ch, uint32_t cb)
+{
+	volatile raspi_DMA15_regs *dma = dma_channel(ch);
+	const struct raspi_DMA_CS_reg start = {
+		.ACTIVE = 1,
+		.END = 1,
+		.INT = 1,
+		.PRIORITY = 8,
+		.PANIC_PRIORITY = 15,
+		.WAIT_FOR_OUTSTANDING_WRITES = 1,
+	};
+
+	memory_barrier();
+	dma->CONBLK_AD = cb;
+	dma->CS.B = start;
+	memory_barrier();
+}
+
+
+/// Return true while DMA channel _ch_ is still processing control blocks.
+static inline int dma_busy(int ch)
+{
+	return dma_channel(ch)->CS.B.ACTIVE;
+}
+
+
+/// Return true if DMA channel _ch_ has flagged an error.
+static inline int dma_error(int ch)
+{
+	return dma_channel(ch)->CS.B.ERROR;
+}
+
+
+/// Block until DMA channel _ch_ has finished its transfer.
+static inline void dma_wait(int ch)
+{
+	while (dma_busy(ch));
+	memory_barrier();
+}
+
+
+/// Block until DMA channel _ch_ has finished its transfer, but at most for
+/// _timeout_ system timer ticks.  Return false on timeout or error.
+static inline int dma_wait_timeout(int ch, st_delta_t timeout)
+{
+	st_time_t start = ST_NOW;
+
+	while (dma_busy(ch)) {
+		if (dma_error(ch) || st_elapsed(start, ST_NOW, timeout)) return 0;
+	}
+	memory_barrier();
+	return !dma_error(ch);
+}
+
+
+/// Return true if DMA channel _ch_ is currently processing the control block
+/// at bus address _cb_.  Useful to track the progress of a chain.
+static inline int dma_at(int ch, uint32_t cb)
+{
+	return dma_channel(ch)->CONBLK_AD == cb;
+}
+
+
+/**
+ * @name Channel allocation
+ *
+ * Channels are reserved in @ref dma_channels_reserved, which is defined in
+ * hw.c.  Reservations are not shared between processes.
+ *
+ * @{
+ */
+
+/// Channels usable by the kernel, if the device tree is not available.
+#define DMA_CHANNEL_MASK_DEFAULT 0x7f35
+
+/// Channels 0-6 support 2D mode and long transfers.
+#define DMA_CHANNEL_MASK_FULL 0x007f
+
+/// Bit _n_ is set if channel _n_ has been reserved by dma_channel_alloc().
+extern uint32_t dma_channels_reserved;
+
+#if defined(linux) && !defined(__KERNEL__)
+/// Return the `brcm,dma-channel-mask` device tree property, or
+/// @ref DMA_CHANNEL_MASK_DEFAULT if unavailable.  Defined in hw.c.
+extern uint32_t raspi_dma_channel_mask(void);
+#else
+#define raspi_dma_channel_mask() DMA_CHANNEL_MASK_DEFAULT
+#endif
+
+
+/// Reserve and reset a channel from _mask_ (e.g. @ref DMA_CHANNEL_MASK_FULL
+/// or ~0) which the firmware does not own, and which is idle and has never
+/// been started, i.e. not in use by the kernel either.  Return the channel
+/// number, or -1 if none is available.
+static inline int dma_channel_alloc(uint32_t mask)
+{
+	int ch;
+
+	// unused channels are typically at the end of the kernel's range
+	mask &= raspi_dma_channel_mask() & ~dma_channels_reserved;
+	for (ch = 14; ch >= 0; ch--) {
+		volatile raspi_DMA15_regs *dma = dma_channel(ch);
+
+		if (!(mask & 1u << ch)) continue;
+		if (dma->CS.B.ACTIVE || dma->CONBLK_AD) continue;
+
+		dma_channels_reserved |= 1u << ch;
+		dma_reset(ch);
+		return ch;
+	}
+
+	return -1;
+}
+
+
+/// Reset channel _ch_ and release the reservation made by dma_channel_alloc().
+static inline void dma_channel_free(int ch)
+{
+	if (ch < 0) return;
+	dma_reset(ch);
+	dma_channels_reserved &= ~(1u << ch);
+}
+
+/// @}
+
+
+/**
+ * @name Control block pools
+ *
+ * A pool hands out control blocks from a block of DMA memory, e.g. one
+ * obtained with raspi_mem_alloc().  Blocks are released all at once.
+ *
+ * @{
+ */
+
+/// Control block pool.
+typedef struct {
+	/// DMA memory holding the control blocks
+	raspi_mem_t *mem;
+	/// Capacity in control blocks
+	uint32_t num;
+	/// Control blocks handed out so far
+	uint32_t used;
+} dma_pool_t;
+
+
+/// Initialize _pool_ to hand out control blocks from _mem_.
+static inline void dma_pool_init(dma_pool_t *pool, raspi_mem_t *mem)
+{
+	pool->mem = mem;
+	pool->num = mem->size / sizeof(raspi_dma_control_block);
+	pool->used = 0;
+}
+
+
+/// Take _num_ consecutive control blocks from _pool_.  Return NULL if the pool
+/// is exhausted.
+static inline volatile raspi_dma_control_block *dma_pool_alloc(dma_pool_t *pool, uint32_t num)
+{
+	volatile raspi_dma_control_block *cb;
+
+	if (num > pool->num - pool->used) return 0;
+	cb = (volatile raspi_dma_control_block *)pool->mem->virt + pool->used;
+	pool->used += num;
+	return cb;
+}
+
+
+/// Return the bus address of control block _cb_ taken from _pool_.
+static inline uint32_t dma_pool_bus(const dma_pool_t *pool, volatile raspi_dma_control_block *cb)
+{
+	return MEM_BUS(pool->mem, cb);
+}
+
+
+/// Return all control blocks to _pool_.  None of them may be in use.
+static inline void dma_pool_reset(dma_pool_t *pool)
+{
+	pool->used = 0;
+}
+
+/// @}
+
+#endif
+
+///@}
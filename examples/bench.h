@@ -0,0 +1,160 @@
+/**
+ * @file
+ *
+ * Common helpers of the benchmark examples: sample collection, statistics and
+ * a jitter histogram, based on the system timer and, if `BENCH_CYCLES` is
+ * defined, the ARM cycle counter.  The cycle counter must have been enabled
+ * for user mode by the kernel, or reading it raises SIGILL.
+ *
+ * Every benchmark runs with locked memory at the highest SCHED_FIFO priority
+ * if permitted, so it gives meaningful numbers under PREEMPT_RT and Xenomai.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef RASPI_DIRECTHW_BENCH_H
+#define RASPI_DIRECTHW_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "../hw.h"
+
+#ifdef __XENO__
+#include <rtdk.h>
+#define printf rt_printf
+#endif
+
+#ifndef BENCH_SAMPLES
+/// Number of samples per measurement.
+#define BENCH_SAMPLES 1000
+#endif
+
+/// Number of buckets of the jitter histogram.
+#define BENCH_BUCKETS 16
+
+/// Convert system timer _ticks_ to ns.
+#define BENCH_NS(ticks) ((ticks) * (1000000000u / ST_1s))
+
+
+/// Samples of one measurement.
+typedef struct {
+	const char *name;
+	const char *unit;
+	uint32_t num;
+	uint32_t value[BENCH_SAMPLES];
+} bench_t;
+
+
+/// Return the ARM cycle counter.
+static inline uint32_t bench_cycles(void)
+{
+	uint32_t cycles = 0;
+#if defined(BENCH_CYCLES) && defined(__arm__)
+#if __ARM_ARCH >= 7
+	asm volatile ("mrc p15, 0, %0, c9, c13, 0" : "=r" (cycles));
+#else
+	asm volatile ("mrc p15, 0, %0, c15, c12, 1" : "=r" (cycles));
+#endif
+#endif
+	return cycles;
+}
+
+
+/// Lock memory, raise the priority and map the hardware.  Exit on error.
+static void bench_setup(void)
+{
+	struct sched_param param = { 99 };
+
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+	if (sched_setscheduler(0, SCHED_FIFO, &param))
+		perror("Running without real-time priority");
+
+	if (!raspi_map_hw()) {
+		perror("Could not map hardware registers");
+		exit(1);
+	}
+}
+
+
+/// Start collecting samples for measurement _name_, given in _unit_.
+static void bench_init(bench_t *bench, const char *name, const char *unit)
+{
+	bench->name = name;
+	bench->unit = unit;
+	bench->num = 0;
+}
+
+
+/// Add one sample.  Return false once the measurement is complete.
+static int bench_add(bench_t *bench, uint32_t value)
+{
+	if (bench->num < BENCH_SAMPLES) bench->value[bench->num++] = value;
+	return bench->num < BENCH_SAMPLES;
+}
+
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/// Print min, median, 99th percentile and max, followed by a histogram of the
+/// deviations from the minimum in power-of-two buckets.
+static void bench_report(bench_t *bench)
+{
+	uint32_t count[BENCH_BUCKETS] = { 0 };
+	uint32_t *v = bench->value;
+	uint32_t n = bench->num;
+	uint32_t i;
+
+	if (!n) {
+		printf("%-32s no samples\n", bench->name);
+		return;
+	}
+
+	qsort(v, n, sizeof(v[0]), bench_compare);
+	printf("%-32s min %8u  median %8u  p99 %8u  max %8u %s\n", bench->name,
+			v[0], v[n/2], v[n*99/100], v[n-1], bench->unit);
+
+	for (i = 0; i < n; i++) {
+		uint32_t jitter = v[i] - v[0];
+		int bucket = 0;
+		while (jitter && bucket < BENCH_BUCKETS - 1) {
+			jitter >>= 1;
+			bucket++;
+		}
+		count[bucket]++;
+	}
+
+	for (i = 0; i < BENCH_BUCKETS; i++) {
+		uint32_t bar = (count[i] * 50 + n - 1) / n;
+		if (!count[i]) continue;
+		printf("    +%8u %-6s %6u ", i ? 1u << (i - 1) : 0, bench->unit, count[i]);
+		while (bar--) putchar('#');
+		putchar('\n');
+	}
+}
+
+#endif
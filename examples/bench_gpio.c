@@ -0,0 +1,83 @@
+/**
+ * @example bench_gpio.c
+ *
+ * GPIO benchmark.  Measures the toggle rate of one output and the cost of
+ * gpio_configure(), which includes the pull-up/down sequence.  The GPIO is
+ * given as first argument and defaults to 16 (LED D5 on the original Pi).
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "bench.h"
+#include "../hw.c"
+
+/// Toggles per sample, so the system timer resolution does not matter.
+#define TOGGLES 1000
+
+static bench_t bench;
+
+int main(int argc, char *argv[])
+{
+	int gpio = argc > 1 ? atoi(argv[1]) : 16;
+	st_time_t start;
+	uint32_t i;
+
+	bench_setup();
+	gpio_configure(gpio, Output, PullOff);
+
+	bench_init(&bench, "gpio_set + gpio_clear", "ns");
+	do {
+		start = ST_NOW;
+		for (i = 0; i < TOGGLES; i++) {
+			gpio_set(gpio);
+			gpio_clear(gpio);
+		}
+		memory_barrier();
+	} while (bench_add(&bench, BENCH_NS(ST_NOW - start) / TOGGLES));
+	bench_report(&bench);
+
+#ifdef BENCH_CYCLES
+	bench_init(&bench, "gpio_set + gpio_clear", "cycles");
+	do {
+		start = bench_cycles();
+		gpio_set(gpio);
+		gpio_clear(gpio);
+		memory_barrier();
+	} while (bench_add(&bench, bench_cycles() - start));
+	bench_report(&bench);
+#endif
+
+	bench_init(&bench, "gpio_read", "ns");
+	do {
+		volatile uint32_t level;
+		start = ST_NOW;
+		for (i = 0; i < TOGGLES; i++) level = gpio_read(gpio);
+		(void)level;
+	} while (bench_add(&bench, BENCH_NS(ST_NOW - start) / TOGGLES));
+	bench_report(&bench);
+
+	bench_init(&bench, "gpio_configure", "us");
+	do {
+		start = ST_NOW;
+		gpio_configure(gpio, Output, PullOff);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @example bench_mbox.c
+ *
+ * Mailbox benchmark.  Measures the latency of property calls to the VideoCore
+ * firmware for several tags, each in its own call, and for all of them in one
+ * batch.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "bench.h"
+#include "../mailbox.h"
+#include "../hw.c"
+
+static bench_t bench;
+
+int main(void)
+{
+	st_time_t start;
+
+	bench_setup();
+
+	bench_init(&bench, "GET_CLOCK_RATE (core)", "us");
+	do {
+		start = ST_NOW;
+		mbox_get_clock(MBOX_CLOCK_CORE);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	bench_init(&bench, "GET_CLOCK_MEASURED (arm)", "us");
+	do {
+		start = ST_NOW;
+		mbox_get_clock_measured(MBOX_CLOCK_ARM);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	bench_init(&bench, "GET_TEMPERATURE", "us");
+	do {
+		MBOX_BATCH(batch, 8);
+		start = ST_NOW;
+		mbox_batch_get_temperature(&batch);
+		mbox_batch_call(&batch);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	bench_init(&bench, "GET_THROTTLED", "us");
+	do {
+		MBOX_BATCH(batch, 8);
+		start = ST_NOW;
+		mbox_batch_get_throttled(&batch);
+		mbox_batch_call(&batch);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	bench_init(&bench, "all of the above in one batch", "us");
+	do {
+		MBOX_BATCH(batch, 32);
+		start = ST_NOW;
+		mbox_batch_get_clock_rate(&batch, MBOX_CLOCK_CORE);
+		mbox_batch_get_clock_measured(&batch, MBOX_CLOCK_ARM);
+		mbox_batch_get_temperature(&batch);
+		mbox_batch_get_throttled(&batch);
+		mbox_batch_call(&batch);
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	raspi_vcio_close();
+	return 0;
+}
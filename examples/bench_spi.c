@@ -0,0 +1,92 @@
+/**
+ * @example bench_spi.c
+ *
+ * SPI0 benchmark.  Measures the sustained throughput of spi_transfer() and
+ * the cost of single spi_write()/spi_read() pairs for a range of clock
+ * dividers, using chip select 0.  No slave needs to be connected.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "bench.h"
+#include "../spi.h"
+#include "../hw.c"
+
+/// Bytes per buffer transfer.
+#define BUFSIZE 4096
+
+/// Single byte transfers per sample, so the system timer resolution does not
+/// matter.
+#define BYTES 100
+
+static bench_t bench;
+static uint8_t tx[BUFSIZE], rx[BUFSIZE];
+
+int main(void)
+{
+	static const uint32_t speeds[] = { 1000000, 4000000, 8000000, 16000000, 32000000 };
+	char name[64];
+	st_time_t start;
+	unsigned int i, j;
+
+	bench_setup();
+	if (!mbox_clock_refresh()) printf("Assuming a core clock of %u Hz\n", CORE_CLOCK);
+
+	for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		uint32_t median;
+
+		spi_init(speeds[i]);
+		spi_start(0);
+
+		snprintf(name, sizeof(name), "spi_transfer %u B, CDIV %u", BUFSIZE, (unsigned)HW.SPI0.CLK.B.CDIV);
+		bench_init(&bench, name, "us");
+		do {
+			start = ST_NOW;
+			spi_transfer(tx, rx, BUFSIZE);
+		} while (bench_add(&bench, ST_NOW - start));
+		bench_report(&bench);
+		median = bench.value[bench.num/2];
+		if (median) printf("    => %u kB/s\n", (unsigned)(BUFSIZE * (ST_1s / 1000) / median));
+
+		snprintf(name, sizeof(name), "spi_write + spi_read, CDIV %u", (unsigned)HW.SPI0.CLK.B.CDIV);
+		bench_init(&bench, name, "ns");
+		do {
+			start = ST_NOW;
+			for (j = 0; j < BYTES; j++) {
+				spi_write(0x55);
+				spi_read();
+			}
+		} while (bench_add(&bench, BENCH_NS(ST_NOW - start) / BYTES));
+		bench_report(&bench);
+
+#ifdef BENCH_CYCLES
+		bench_init(&bench, name, "cycles");
+		do {
+			start = bench_cycles();
+			spi_write(0x55);
+			spi_read();
+		} while (bench_add(&bench, bench_cycles() - start));
+		bench_report(&bench);
+#endif
+
+		spi_stop();
+	}
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @example bench_spisl.c
+ *
+ * PCM SPI slave benchmark.  Measures how long spisl_synchronize() takes to
+ * lock onto the frames of a master, which must be running the
+ * synchronization protocol described there.  The number of rounds is given as
+ * first argument and defaults to 10, since each round needs the cooperation
+ * of the master.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "bench.h"
+#include "../spisl.h"
+#include "../hw.c"
+
+static bench_t bench;
+
+int main(int argc, char *argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 10;
+	st_time_t start;
+
+	bench_setup();
+
+	bench_init(&bench, "spisl_init + spisl_synchronize", "us");
+	while (rounds-- > 0) {
+		start = ST_NOW;
+		spisl_init();
+		spisl_synchronize();
+		bench_add(&bench, ST_NOW - start);
+	}
+	bench_report(&bench);
+
+	return 0;
+}
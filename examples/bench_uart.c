@@ -0,0 +1,82 @@
+/**
+ * @example bench_uart.c
+ *
+ * UART benchmark.  Measures the round-trip latency of a single byte through
+ * UART0 and UART1, i.e. from uart0_write() until uart0_read() returns it.
+ * Requires a loopback connection between TXD (GPIO14) and RXD (GPIO15).  The
+ * bit rate is given as first argument and defaults to 115200 bit/s.
+ *
+ * Both UARTs share the same pins, so they are measured one after the other.
+ * Note that you *must* disable the serial console and getty on the UART.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "bench.h"
+#include "../uart0.h"
+#include "../uart1.h"
+#include "../hw.c"
+
+/// Give up on a byte after this time, assuming there is no loopback
+#define TIMEOUT (100*ST_1ms)
+
+static bench_t bench;
+
+int main(int argc, char *argv[])
+{
+	uint32_t bitrate = argc > 1 ? strtoul(argv[1], 0, 0) : 115200;
+	st_time_t start;
+
+	bench_setup();
+	if (!mbox_clock_refresh()) printf("Assuming a core clock of %u Hz\n", CORE_CLOCK);
+
+	uart0_init(bitrate);
+	while (uart0_poll(1)) uart0_read();
+	bench_init(&bench, "uart0 round trip", "us");
+	do {
+		start = ST_NOW;
+		uart0_write(0x55);
+		while (!uart0_poll(1)) {
+			if (st_elapsed(start, ST_NOW, TIMEOUT)) {
+				printf("uart0: no loopback\n");
+				return 1;
+			}
+		}
+		uart0_read();
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	uart1_init(bitrate);
+	while (uart1_poll(1)) uart1_read();
+	bench_init(&bench, "uart1 round trip", "us");
+	do {
+		start = ST_NOW;
+		uart1_write(0x55);
+		while (!uart1_poll(1)) {
+			if (st_elapsed(start, ST_NOW, TIMEOUT)) {
+				printf("uart1: no loopback\n");
+				return 1;
+			}
+		}
+		uart1_read();
+	} while (bench_add(&bench, ST_NOW - start));
+	bench_report(&bench);
+
+	return 0;
+}
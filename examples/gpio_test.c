@@ -40,7 +40,7 @@
 #define printf rt_printf
 #endif
 
-int main(int argc, char *argv[])
+int main(void)
 {
 #ifdef __XENO__
 	struct sched_param param = { 99 };
@@ -57,7 +57,7 @@ int main(int argc, char *argv[])
 	pthread_set_mode_np(0, PTHREAD_WARNSW|PTHREAD_PRIMARY);
 #endif
 
-	gpio_configure(16, Output);
+	gpio_configure(16, Output, PullOff);
 
 	for (;;) {
 		gpio_set(16);
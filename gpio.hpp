@@ -0,0 +1,387 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup gpio_cpp GPIO Pin Templates (C++)
+ *
+ * C++ layer over the GPIO helpers in `hw.h`, which takes pin numbers as
+ * template arguments.  Banks, masks, function select registers and shifts are
+ * then compile-time constants, so `Pin<16>::set()` is a single store, and a
+ * @ref raspi::PinGroup sets, clears or configures all of its pins with one
+ * store per bank or function select register.
+ *
+ * Alternate functions are selected by peripheral signal, e.g.
+ * `Pin<14>::connect<Signal::UART0_TXD>()`.  The alternate function number is
+ * looked up at compile time, and a pin without that signal fails to compile.
+ *
+ *     using Led = raspi::Pin<16>;
+ *     Led::configure<Output>();
+ *     Led::set();
+ *     raspi::Spi0Pins::connect_all();
+ *
+ * Requires C++14 with GNU extensions, like the C headers.  Compile `hw.c` as
+ * C and link it.
+ *
+ * Declared in `gpio.hpp`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_GPIO_HPP
+#define RASPI_DIRECTHW_GPIO_HPP
+
+#include "hw.h"
+
+namespace raspi {
+
+/// Peripheral signals available as alternate functions.
+enum class Signal {
+	SDA0, SCL0, SDA1, SCL1,
+	GPCLK0, GPCLK1, GPCLK2,
+	SPI0_CE1_N, SPI0_CE0_N, SPI0_MISO, SPI0_MOSI, SPI0_SCLK,
+	PWM0, PWM1,
+	UART0_TXD, UART0_RXD, UART0_CTS, UART0_RTS,
+	UART1_TXD, UART1_RXD, UART1_CTS, UART1_RTS,
+	PCM_CLK, PCM_FS, PCM_DIN, PCM_DOUT,
+	BSCSL_SDA_MOSI, BSCSL_SCL_SCLK, BSCSL_MISO, BSCSL_CE_N,
+	SPI1_CE2_N, SPI1_CE1_N, SPI1_CE0_N, SPI1_MISO, SPI1_MOSI, SPI1_SCLK,
+	SPI2_MISO, SPI2_MOSI, SPI2_SCLK, SPI2_CE0_N, SPI2_CE1_N, SPI2_CE2_N,
+};
+
+/// Function select value of _signal_ on _gpio_, or Input if _gpio_ does not
+/// have it.
+constexpr raspi_GPIO_function alt_function(unsigned gpio, Signal signal)
+{
+	struct Entry {
+		unsigned gpio;
+		Signal signal;
+		raspi_GPIO_function function;
+	};
+
+	const Entry table[] = {
+		{  0, Signal::SDA0, Alt0 },
+		{  1, Signal::SCL0, Alt0 },
+		{  2, Signal::SDA1, Alt0 },
+		{  3, Signal::SCL1, Alt0 },
+		{  4, Signal::GPCLK0, Alt0 },
+		{  5, Signal::GPCLK1, Alt0 },
+		{  6, Signal::GPCLK2, Alt0 },
+		{  7, Signal::SPI0_CE1_N, Alt0 },
+		{  8, Signal::SPI0_CE0_N, Alt0 },
+		{  9, Signal::SPI0_MISO, Alt0 },
+		{ 10, Signal::SPI0_MOSI, Alt0 },
+		{ 11, Signal::SPI0_SCLK, Alt0 },
+		{ 12, Signal::PWM0, Alt0 },
+		{ 13, Signal::PWM1, Alt0 },
+		{ 14, Signal::UART0_TXD, Alt0 },
+		{ 14, Signal::UART1_TXD, Alt5 },
+		{ 15, Signal::UART0_RXD, Alt0 },
+		{ 15, Signal::UART1_RXD, Alt5 },
+		{ 16, Signal::UART0_CTS, Alt3 },
+		{ 16, Signal::SPI1_CE2_N, Alt4 },
+		{ 16, Signal::UART1_CTS, Alt5 },
+		{ 17, Signal::UART0_RTS, Alt3 },
+		{ 17, Signal::SPI1_CE1_N, Alt4 },
+		{ 17, Signal::UART1_RTS, Alt5 },
+		{ 18, Signal::PCM_CLK, Alt0 },
+		{ 18, Signal::BSCSL_SDA_MOSI, Alt3 },
+		{ 18, Signal::SPI1_CE0_N, Alt4 },
+		{ 18, Signal::PWM0, Alt5 },
+		{ 19, Signal::PCM_FS, Alt0 },
+		{ 19, Signal::BSCSL_SCL_SCLK, Alt3 },
+		{ 19, Signal::SPI1_MISO, Alt4 },
+		{ 19, Signal::PWM1, Alt5 },
+		{ 20, Signal::PCM_DIN, Alt0 },
+		{ 20, Signal::BSCSL_MISO, Alt3 },
+		{ 20, Signal::SPI1_MOSI, Alt4 },
+		{ 20, Signal::GPCLK0, Alt5 },
+		{ 21, Signal::PCM_DOUT, Alt0 },
+		{ 21, Signal::BSCSL_CE_N, Alt3 },
+		{ 21, Signal::SPI1_SCLK, Alt4 },
+		{ 21, Signal::GPCLK1, Alt5 },
+		{ 28, Signal::SDA0, Alt0 },
+		{ 28, Signal::PCM_CLK, Alt2 },
+		{ 29, Signal::SCL0, Alt0 },
+		{ 29, Signal::PCM_FS, Alt2 },
+		{ 30, Signal::PCM_DIN, Alt2 },
+		{ 30, Signal::UART0_CTS, Alt3 },
+		{ 30, Signal::UART1_CTS, Alt5 },
+		{ 31, Signal::PCM_DOUT, Alt2 },
+		{ 31, Signal::UART0_RTS, Alt3 },
+		{ 31, Signal::UART1_RTS, Alt5 },
+		{ 32, Signal::GPCLK0, Alt0 },
+		{ 32, Signal::UART0_TXD, Alt3 },
+		{ 32, Signal::UART1_TXD, Alt5 },
+		{ 33, Signal::UART0_RXD, Alt3 },
+		{ 33, Signal::UART1_RXD, Alt5 },
+		{ 34, Signal::GPCLK0, Alt0 },
+		{ 35, Signal::SPI0_CE1_N, Alt0 },
+		{ 36, Signal::SPI0_CE0_N, Alt0 },
+		{ 36, Signal::UART0_TXD, Alt2 },
+		{ 37, Signal::SPI0_MISO, Alt0 },
+		{ 37, Signal::UART0_RXD, Alt2 },
+		{ 38, Signal::SPI0_MOSI, Alt0 },
+		{ 38, Signal::UART0_RTS, Alt2 },
+		{ 39, Signal::SPI0_SCLK, Alt0 },
+		{ 39, Signal::UART0_CTS, Alt2 },
+		{ 40, Signal::PWM0, Alt0 },
+		{ 40, Signal::SPI2_MISO, Alt4 },
+		{ 40, Signal::UART1_TXD, Alt5 },
+		{ 41, Signal::PWM1, Alt0 },
+		{ 41, Signal::SPI2_MOSI, Alt4 },
+		{ 41, Signal::UART1_RXD, Alt5 },
+		{ 42, Signal::GPCLK1, Alt0 },
+		{ 42, Signal::SPI2_SCLK, Alt4 },
+		{ 42, Signal::UART1_RTS, Alt5 },
+		{ 43, Signal::GPCLK2, Alt0 },
+		{ 43, Signal::SPI2_CE0_N, Alt4 },
+		{ 43, Signal::UART1_CTS, Alt5 },
+		{ 44, Signal::GPCLK1, Alt0 },
+		{ 44, Signal::SDA0, Alt1 },
+		{ 44, Signal::SDA1, Alt2 },
+		{ 44, Signal::SPI2_CE1_N, Alt4 },
+		{ 45, Signal::PWM1, Alt0 },
+		{ 45, Signal::SCL0, Alt1 },
+		{ 45, Signal::SCL1, Alt2 },
+		{ 45, Signal::SPI2_CE2_N, Alt4 },
+	};
+
+	for (const Entry &entry : table) {
+		if (entry.gpio == gpio && entry.signal == signal) return entry.function;
+	}
+	return Input;
+}
+
+
+/**
+ * Any number of GPIOs, which are accessed together.  Setting or clearing them
+ * takes one store per bank, configuring them one read-modify-write per
+ * function select register involved.
+ */
+template <unsigned... N>
+struct PinGroup {
+	static_assert(sizeof...(N) > 0, "empty pin group");
+
+	/// Return true if all pins exist and none is listed twice.
+	static constexpr bool valid()
+	{
+		const unsigned pins[] = { N... };
+		for (unsigned i = 0; i < sizeof...(N); i++) {
+			if (pins[i] > 53) return false;
+			for (unsigned j = 0; j < i; j++) {
+				if (pins[i] == pins[j]) return false;
+			}
+		}
+		return true;
+	}
+	static_assert(valid(), "pin group contains invalid or duplicate GPIOs");
+
+	/// Return the mask of all pins in bank _bank_.
+	static constexpr uint32_t mask(unsigned bank)
+	{
+		const unsigned pins[] = { N... };
+		uint32_t result = 0;
+		for (unsigned pin : pins) {
+			if (GPIO_BANK(pin) == bank) result |= GPIO_BIT(pin);
+		}
+		return result;
+	}
+
+	/// Return the bits of function select register _reg_ used by the pins.
+	static constexpr uint32_t fsel_mask(unsigned reg)
+	{
+		const unsigned pins[] = { N... };
+		uint32_t result = 0;
+		for (unsigned pin : pins) {
+			if (pin / 10 == reg) result |= 7u << (pin % 10 * 3);
+		}
+		return result;
+	}
+
+	/// Return the value of function select register _reg_ selecting
+	/// _function_ for all pins.
+	static constexpr uint32_t fsel_bits(unsigned reg, raspi_GPIO_function function)
+	{
+		return fsel_mask(reg) & (0x09249249u * (function & 7));
+	}
+
+	/// Set (to logical high) all outputs.
+	static void set()
+	{
+		if (mask(0)) HW.GPIO.SET[0] = mask(0);
+		if (mask(1)) HW.GPIO.SET[1] = mask(1);
+	}
+
+	/// Clear (set to logical low) all outputs.
+	static void clear()
+	{
+		if (mask(0)) HW.GPIO.CLR[0] = mask(0);
+		if (mask(1)) HW.GPIO.CLR[1] = mask(1);
+	}
+
+	/// Drive all outputs to _level_.
+	static void write(bool level)
+	{
+		if (level) set();
+		else clear();
+	}
+
+	/// Configure all pins for function _F_ and pull-up/down _pull_.
+	template <raspi_GPIO_function F>
+	static void configure(raspi_GPIO_pull pull = PullOff)
+	{
+		Fsel<0, fsel_mask(0), fsel_bits(0, F)>::apply();
+		Fsel<1, fsel_mask(1), fsel_bits(1, F)>::apply();
+		Fsel<2, fsel_mask(2), fsel_bits(2, F)>::apply();
+		Fsel<3, fsel_mask(3), fsel_bits(3, F)>::apply();
+		Fsel<4, fsel_mask(4), fsel_bits(4, F)>::apply();
+		Fsel<5, fsel_mask(5), fsel_bits(5, F)>::apply();
+		pull_all(pull);
+	}
+
+	/// Connect the pins, in order, to the peripheral signals _S_.  Fails to
+	/// compile if a pin does not have its signal.
+	template <Signal... S>
+	static void connect(raspi_GPIO_pull pull = PullOff)
+	{
+		static_assert(sizeof...(S) == sizeof...(N), "need one signal per pin");
+		static_assert(connectable<S...>(), "signal not available on this pin");
+		Fsel<0, fsel_mask(0), connect_bits<S...>(0)>::apply();
+		Fsel<1, fsel_mask(1), connect_bits<S...>(1)>::apply();
+		Fsel<2, fsel_mask(2), connect_bits<S...>(2)>::apply();
+		Fsel<3, fsel_mask(3), connect_bits<S...>(3)>::apply();
+		Fsel<4, fsel_mask(4), connect_bits<S...>(4)>::apply();
+		Fsel<5, fsel_mask(5), connect_bits<S...>(5)>::apply();
+		pull_all(pull);
+	}
+
+private:
+	template <unsigned R, uint32_t Clear, uint32_t Set>
+	struct Fsel {
+		static void apply()
+		{
+			if (!Clear) return;
+			GPIO_LOCK(gpio_fsel_lock[R]);
+			HW.GPIO.FSEL[R] = (HW.GPIO.FSEL[R] & ~Clear) | Set;
+			GPIO_UNLOCK(gpio_fsel_lock[R]);
+		}
+	};
+
+	template <Signal... S>
+	static constexpr bool connectable()
+	{
+		const raspi_GPIO_function functions[] = { alt_function(N, S)... };
+		for (raspi_GPIO_function function : functions) {
+			if (function == Input) return false;
+		}
+		return true;
+	}
+
+	template <Signal... S>
+	static constexpr uint32_t connect_bits(unsigned reg)
+	{
+		const unsigned pins[] = { N... };
+		const raspi_GPIO_function functions[] = { alt_function(N, S)... };
+		uint32_t result = 0;
+		for (unsigned i = 0; i < sizeof...(N); i++) {
+			if (pins[i] / 10 == reg) result |= (functions[i] & 7u) << (pins[i] % 10 * 3);
+		}
+		return result;
+	}
+
+	static void pull_all(raspi_GPIO_pull pull)
+	{
+		gpio_pull_mask(0, mask(0), pull);
+		gpio_pull_mask(1, mask(1), pull);
+	}
+};
+
+
+/// A single GPIO.  See @ref PinGroup.
+template <unsigned N>
+struct Pin : PinGroup<N> {
+	/// Bank of the pin
+	static constexpr unsigned bank = GPIO_BANK(N);
+	/// Mask of the pin within its bank
+	static constexpr uint32_t bit = GPIO_BIT(N);
+
+	/// Return true if the pin is driven high.
+	static bool read()
+	{
+		return HW.GPIO.LEV[GPIO_BANK(N)] & GPIO_BIT(N);
+	}
+
+	/// Connect the pin to peripheral signal _S_.  Fails to compile if the pin
+	/// does not have that signal.
+	template <Signal S>
+	static void connect(raspi_GPIO_pull pull = PullOff)
+	{
+		PinGroup<N>::template connect<S>(pull);
+	}
+};
+
+
+/// SPI0 on GPIO7-11 with both chip selects.
+struct Spi0Pins : PinGroup<7, 8, 9, 10, 11> {
+	static void connect_all()
+	{
+		connect<Signal::SPI0_CE1_N, Signal::SPI0_CE0_N, Signal::SPI0_MISO, Signal::SPI0_MOSI, Signal::SPI0_SCLK>();
+	}
+};
+
+/// SPI1 on GPIO16-21 with all three chip selects.
+struct Spi1Pins : PinGroup<16, 17, 18, 19, 20, 21> {
+	static void connect_all()
+	{
+		connect<Signal::SPI1_CE2_N, Signal::SPI1_CE1_N, Signal::SPI1_CE0_N, Signal::SPI1_MISO, Signal::SPI1_MOSI, Signal::SPI1_SCLK>();
+	}
+};
+
+/// I2C bus 1 on GPIO2/3, with pull-ups.
+struct I2c1Pins : PinGroup<2, 3> {
+	static void connect_all()
+	{
+		connect<Signal::SDA1, Signal::SCL1>(PullUp);
+	}
+};
+
+/// UART0 on GPIO14/15.
+struct Uart0Pins : PinGroup<14, 15> {
+	static void connect_all()
+	{
+		connect<Signal::UART0_TXD, Signal::UART0_RXD>();
+	}
+};
+
+/// PCM on GPIO18-21.
+struct PcmPins : PinGroup<18, 19, 20, 21> {
+	static void connect_all()
+	{
+		connect<Signal::PCM_CLK, Signal::PCM_FS, Signal::PCM_DIN, Signal::PCM_DOUT>();
+	}
+};
+
+}
+
+#endif
+
+///@}
@@ -0,0 +1,238 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup gpio_event GPIO Edge Events
+ *
+ * These functions capture edges on GPIO inputs with the edge detectors of the
+ * GPIO block, which latch each armed edge in `HW.GPIO.EDS` until it is
+ * cleared.  Unlike polling with gpio_read(), short pulses are not missed
+ * between polls.  Several edges of one pin between two drains are reported as
+ * a single event, though.
+ *
+ * gpio_events_poll() drains the latched edges of all armed pins with one
+ * register read per bank, timestamps them with @ref ST_NOW and stores them in
+ * a ring buffer per pin.  Call it either periodically, e.g. from a
+ * st_periodic_wait() loop (see `timer.h`), or from the handler of the GPIO
+ * interrupts in kernel, Xenomai or bare-metal code after
+ * gpio_events_irq_enable().  Draining acknowledges the interrupt.  The
+ * timestamp then has the interrupt latency as its only error.
+ *
+ * The rings are single-producer, single-consumer: one context may call
+ * gpio_events_poll() while another calls gpio_events_read().
+ *
+ * Declared in `gpio_event.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_GPIO_EVENT_H
+#define RASPI_DIRECTHW_GPIO_EVENT_H
+
+#include "hw.h"
+
+#ifndef GPIO_EVENT_RING
+/// Number of events buffered per pin.  Must be a power of two.
+#define GPIO_EVENT_RING 16
+#endif
+
+/// Number of GPIOs with edge detectors.
+#define GPIO_EVENT_PINS 54
+
+/// Trigger on rising edges, synchronized to the system clock.
+#define GPIO_EDGE_RISING 1
+/// Trigger on falling edges, synchronized to the system clock.
+#define GPIO_EDGE_FALLING 2
+/// Use the asynchronous detectors instead, which also catch pulses shorter
+/// than a system clock cycle, but do not filter glitches.
+#define GPIO_EDGE_ASYNC 4
+
+/// Interrupt number of bank 0 in the GPU interrupt table.  Bank 1 is next.
+#define GPIO_EVENT_IRQ 49
+
+
+/// An edge of one GPIO.
+typedef struct {
+	/// System timer timestamp of the drain that found the edge
+	st_time_t time;
+	/// Level of the pin at that time, i.e. nonzero after a rising edge unless
+	/// the pin has changed again meanwhile
+	uint32_t level;
+} gpio_event_t;
+
+
+/// Events of one GPIO.
+typedef struct {
+	gpio_event_t event[GPIO_EVENT_RING];
+	/// Number of events written, modified by the producer only
+	volatile uint32_t head;
+	/// Number of events read, modified by the consumer only
+	volatile uint32_t tail;
+	/// Number of events dropped because the ring was full
+	volatile uint32_t lost;
+} gpio_event_ring_t;
+
+
+/// State of edge capture for all GPIOs.
+typedef struct {
+	/// Armed pins per bank
+	uint32_t armed[2];
+	gpio_event_ring_t ring[GPIO_EVENT_PINS];
+} gpio_events_t;
+
+
+/// Initialize _events_ with no pins armed and all rings empty.
+static inline void gpio_events_init(gpio_events_t *events)
+{
+	int i;
+
+	events->armed[0] = 0;
+	events->armed[1] = 0;
+	for (i = 0; i < GPIO_EVENT_PINS; i++) {
+		events->ring[i].head = 0;
+		events->ring[i].tail = 0;
+		events->ring[i].lost = 0;
+	}
+}
+
+
+/// Arm the edge detectors of all GPIOs in bank _bank_ whose bits are set in
+/// _mask_ for _edges_, a combination of @ref GPIO_EDGE_RISING,
+/// @ref GPIO_EDGE_FALLING and @ref GPIO_EDGE_ASYNC.  Edges armed or latched
+/// before are discarded.
+static inline void gpio_events_arm(gpio_events_t *events, int bank, uint32_t mask, int edges)
+{
+	volatile uint32_t *rise = edges & GPIO_EDGE_ASYNC ? HW.GPIO.AREN : HW.GPIO.REN;
+	volatile uint32_t *fall = edges & GPIO_EDGE_ASYNC ? HW.GPIO.AFEN : HW.GPIO.FEN;
+
+	// drop the edges of a previous arming, or they would keep triggering
+	HW.GPIO.REN[bank] &= ~mask;
+	HW.GPIO.FEN[bank] &= ~mask;
+	HW.GPIO.AREN[bank] &= ~mask;
+	HW.GPIO.AFEN[bank] &= ~mask;
+
+	if (edges & GPIO_EDGE_RISING) rise[bank] |= mask;
+	if (edges & GPIO_EDGE_FALLING) fall[bank] |= mask;
+	HW.GPIO.EDS[bank] = mask;
+	memory_barrier();
+	events->armed[bank] |= mask;
+}
+
+
+/// Disarm the edge detectors of all GPIOs in bank _bank_ whose bits are set in
+/// _mask_.  Events already buffered remain available.
+static inline void gpio_events_disarm(gpio_events_t *events, int bank, uint32_t mask)
+{
+	events->armed[bank] &= ~mask;
+	HW.GPIO.REN[bank] &= ~mask;
+	HW.GPIO.FEN[bank] &= ~mask;
+	HW.GPIO.AREN[bank] &= ~mask;
+	HW.GPIO.AFEN[bank] &= ~mask;
+	HW.GPIO.EDS[bank] = mask;
+	memory_barrier();
+}
+
+
+/// Enable the GPU interrupt of bank _bank_, which is raised while any edge of
+/// that bank is latched.
+static inline void gpio_events_irq_enable(int bank)
+{
+	memory_barrier();
+	HW.IRQ.enable[1] = 1u << (GPIO_EVENT_IRQ - 32 + bank);
+	memory_barrier();
+}
+
+
+/// Disable the GPU interrupt of bank _bank_.
+static inline void gpio_events_irq_disable(int bank)
+{
+	memory_barrier();
+	HW.IRQ.disable[1] = 1u << (GPIO_EVENT_IRQ - 32 + bank);
+	memory_barrier();
+}
+
+
+/// Move the edges latched for armed pins into their rings and clear them.
+/// Return the number of events found.
+static inline uint32_t gpio_events_poll(gpio_events_t *events)
+{
+	uint32_t found = 0;
+	int bank;
+
+	memory_barrier();
+	for (bank = 0; bank < 2; bank++) {
+		uint32_t eds = HW.GPIO.EDS[bank] & events->armed[bank];
+		st_time_t now;
+		uint32_t level;
+
+		if (!eds) continue;
+		now = ST_NOW;
+		level = HW.GPIO.LEV[bank];
+		HW.GPIO.EDS[bank] = eds;
+
+		while (eds) {
+			int bit = __builtin_ctz(eds);
+			gpio_event_ring_t *ring = &events->ring[32*bank + bit];
+			uint32_t head = ring->head;
+
+			eds &= eds - 1;
+			found++;
+			if (head - ring->tail >= GPIO_EVENT_RING) {
+				ring->lost++;
+				continue;
+			}
+			ring->event[head % GPIO_EVENT_RING].time = now;
+			ring->event[head % GPIO_EVENT_RING].level = level & (1u << bit);
+			memory_barrier();
+			ring->head = head + 1;
+		}
+	}
+	memory_barrier();
+
+	return found;
+}
+
+
+/// Return the number of events buffered for GPIO _gpio_.
+static inline uint32_t gpio_events_available(const gpio_events_t *events, int gpio)
+{
+	return events->ring[gpio].head - events->ring[gpio].tail;
+}
+
+
+/// Remove the oldest event of GPIO _gpio_ and store it in _event_.  Return
+/// false if there is none.  Never blocks.
+static inline int gpio_events_read(gpio_events_t *events, int gpio, gpio_event_t *event)
+{
+	gpio_event_ring_t *ring = &events->ring[gpio];
+	uint32_t tail = ring->tail;
+
+	if (ring->head == tail) return 0;
+	memory_barrier();
+	*event = ring->event[tail % GPIO_EVENT_RING];
+	ring->tail = tail + 1;
+	return 1;
+}
+
+#endif
+
+///@}
@@ -1,8 +1,10 @@
 /**
  * @file
  *
- * Definitions for the hardware register structure HW and initialization
- * function raspi_map_hw().  Anything else is contained in hw.h.
+ * Definitions for the hardware register structure HW, the clock rate table,
+ * the DMA channel reservations, the trace rings, the GPIO locks, and
+ * initialization functions raspi_map_hw() and raspi_map_hw_select().
+ * Anything else is contained in hw.h.
  *
  * Due to its small size, you may want to #`include` this file in exactly one of
  * your source files instead of compiling and linking it separately.
@@ -26,21 +28,44 @@
  *
  */
 
-#if defined(linux) && !defined(__KERNEL__)
-
 #include "hw.h"
+#include "mailbox.h"
+#include "dma.h"
+
+mbox_clock_table_t mbox_clock_table;
+
+uint32_t dma_channels_reserved;
+
+#ifdef RASPI_DIRECTHW_TRACE
+RASPI_TRACE_THREAD raspi_trace_ring_t raspi_trace_ring;
+#endif
+
+#ifdef RASPI_DIRECTHW_SMP
+volatile uint32_t gpio_fsel_lock[6];
+volatile uint32_t gpio_pud_lock;
+#endif
+
+#if defined(linux) && !defined(__KERNEL__)
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <assert.h>
+#include <stddef.h>
 
 raspi_peripherals *pHW = (raspi_peripherals *)0;
 
-int raspi_map_hw(void)
-{
-	if (pHW) return 1;
+// Physical base address of the peripherals, as determined by raspi_map_hw()
+static uint32_t raspi_arm_io_base;
+
+// Property interface of the firmware mailbox driver, see
+// linux/drivers/char/broadcom/vcio.c
+#define RASPI_VCIO_PROPERTY _IOWR(100, 0, char *)
 
+// Return the physical base address of the peripherals
+static uint32_t raspi_detect_io_base(void)
+{
 	// Fallback value for original Pi, later ones should always have /proc
 	uint32_t arm_io_base = 0x20000000ul;
 
@@ -65,19 +90,272 @@ int raspi_map_hw(void)
 		close(fd);
 	}
 
-	fd = open("/dev/mem", O_RDWR|O_SYNC);
+	return arm_io_base;
+}
+
+// Peripherals currently accessible through pHW
+uint32_t raspi_hw_mapped;
+
+int raspi_map_hw(void)
+{
+	if (pHW) return raspi_map_hw_select(RASPI_MAP_ALL);
+
+	raspi_arm_io_base = raspi_detect_io_base();
+
+	int fd = open("/dev/mem", O_RDWR|O_SYNC);
 
 	if (fd < 0) return 0;
 
-	void *addr = mmap(NULL, sizeof(raspi_peripherals), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_LOCKED|MAP_POPULATE, fd, arm_io_base);
+	void *addr = mmap(NULL, sizeof(raspi_peripherals), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_LOCKED|MAP_POPULATE, fd, raspi_arm_io_base);
 
 	close(fd);
 
 	if (addr == MAP_FAILED)  return 0;
 
 	pHW = (raspi_peripherals *)addr;
+	raspi_hw_mapped = RASPI_MAP_ALL;
 
 	return 1;
 }
 
+// Byte range of the register blocks from _first_ to _last_ in raspi_peripherals
+#define RASPI_MAP_SPAN(first, last) \
+	offsetof(raspi_peripherals, first), \
+	offsetof(raspi_peripherals, last) + sizeof(((raspi_peripherals *)0)->last)
+
+static const struct {
+	uint32_t mask;
+	uint32_t start;
+	uint32_t end;
+} raspi_map_table[] = {
+	{ RASPI_MAP_ST,    RASPI_MAP_SPAN(ST, ST) },
+	{ RASPI_MAP_DMA,   RASPI_MAP_SPAN(DMA, DMA_GLOBAL) },
+	{ RASPI_MAP_IRQ,   RASPI_MAP_SPAN(IRQ, MBOX1) },
+	{ RASPI_MAP_PM,    RASPI_MAP_SPAN(PM, PM) },
+	{ RASPI_MAP_CM,    RASPI_MAP_SPAN(CM, CM) },
+	{ RASPI_MAP_RNG,   RASPI_MAP_SPAN(RNG, RNG) },
+	{ RASPI_MAP_GPIO,  RASPI_MAP_SPAN(GPIO, GPIO) },
+	{ RASPI_MAP_UART0, RASPI_MAP_SPAN(UART0, UART0) },
+	{ RASPI_MAP_MMC,   RASPI_MAP_SPAN(MMC, MMC) },
+	{ RASPI_MAP_PCM,   RASPI_MAP_SPAN(PCM, PCM) },
+	{ RASPI_MAP_SPI0,  RASPI_MAP_SPAN(SPI0, SPI0) },
+	{ RASPI_MAP_BSC0,  RASPI_MAP_SPAN(BSC0, BSC0) },
+	{ RASPI_MAP_PWM,   RASPI_MAP_SPAN(PWM, PWM) },
+	{ RASPI_MAP_BSCSL, RASPI_MAP_SPAN(BSCSL, BSCSL) },
+	{ RASPI_MAP_AUX,   RASPI_MAP_SPAN(AUX, SPI2) },
+	{ RASPI_MAP_EMMC,  RASPI_MAP_SPAN(EMMC, EMMC) },
+	{ RASPI_MAP_BSC1,  RASPI_MAP_SPAN(BSC1, BSC1) },
+	{ RASPI_MAP_BSC2,  RASPI_MAP_SPAN(BSC2, BSC2) },
+	{ RASPI_MAP_USB,   RASPI_MAP_SPAN(USB, USB) },
+	{ RASPI_MAP_DMA15, RASPI_MAP_SPAN(DMA15, DMA15) },
+};
+
+int raspi_map_hw_select(uint32_t peripherals)
+{
+	uint32_t missing = peripherals & RASPI_MAP_ALL & ~raspi_hw_mapped;
+	uint32_t page = sysconf(_SC_PAGESIZE);
+	unsigned int i;
+
+	if (!missing) return 1;
+
+	if (!pHW) {
+		raspi_arm_io_base = raspi_detect_io_base();
+
+		// Reserve address space for all peripherals, so offsets within HW
+		// stay valid.  Unmapped parts fault on access.
+		void *addr = mmap(NULL, sizeof(raspi_peripherals), PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (addr == MAP_FAILED) return 0;
+		pHW = (raspi_peripherals *)addr;
+	}
+
+	int fd = open("/dev/mem", O_RDWR|O_SYNC);
+
+	if (fd < 0) {
+		// /dev/gpiomem maps the GPIO block at offset 0, but not the system
+		// timer, so gpio_configure() falls back to a spin loop
+		if (missing != RASPI_MAP_GPIO) return 0;
+		fd = open("/dev/gpiomem", O_RDWR|O_SYNC);
+		if (fd < 0) return 0;
+
+		void *addr = mmap((uint8_t *)pHW + offsetof(raspi_peripherals, GPIO), page, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) return 0;
+
+		raspi_hw_mapped |= RASPI_MAP_GPIO;
+		return 1;
+	}
+
+	// The pull-up/down sequence and tracing rely on the system timer
+	if (missing & RASPI_MAP_GPIO) missing |= RASPI_MAP_ST & ~raspi_hw_mapped;
+
+	for (i = 0; i < sizeof(raspi_map_table) / sizeof(raspi_map_table[0]); i++) {
+		if (!(missing & raspi_map_table[i].mask)) continue;
+
+		uint32_t start = raspi_map_table[i].start & ~(page - 1);
+		uint32_t end = (raspi_map_table[i].end + page - 1) & ~(page - 1);
+		void *addr = mmap((uint8_t *)pHW + start, end - start, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED|MAP_LOCKED, fd, raspi_arm_io_base + start);
+		if (addr == MAP_FAILED) break;
+
+		raspi_hw_mapped |= raspi_map_table[i].mask;
+	}
+
+	close(fd);
+
+	return !(peripherals & RASPI_MAP_ALL & ~raspi_hw_mapped);
+}
+
+// File descriptor of /dev/vcio, opened on first use, or -1
+static int raspi_vcio_fd = -1;
+
+// Send a property tag buffer to the firmware through the kernel's mailbox
+// driver.  We cannot use mbox_call() in user space, since the firmware needs a
+// bus address, which we don't know for the caller's buffer, and the kernel
+// driver consumes all replies.  The device stays open, so periodic batches
+// cost a single ioctl each.
+int raspi_vcio_call(void *buf)
+{
+	RASPI_TRACE_BEGIN(RASPI_TRACE_MBOX_CALL);
+	int fd = raspi_vcio_fd;
+	if (fd < 0) {
+		fd = open("/dev/vcio", O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			RASPI_TRACE_END(RASPI_TRACE_MBOX_CALL);
+			return 0;
+		}
+
+		// Another thread may have opened the device meanwhile
+		if (!__sync_bool_compare_and_swap(&raspi_vcio_fd, -1, fd)) {
+			close(fd);
+			fd = raspi_vcio_fd;
+		}
+	}
+
+	int ret = ioctl(fd, RASPI_VCIO_PROPERTY, buf);
+	RASPI_TRACE_END(RASPI_TRACE_MBOX_CALL);
+
+	return ret >= 0 && ((mbox_property_header_t *)buf)->code == PROP_RESPONSE_SUCCESS;
+}
+
+void raspi_vcio_close(void)
+{
+	int fd = __sync_lock_test_and_set(&raspi_vcio_fd, -1);
+	if (fd >= 0) close(fd);
+}
+
+void *raspi_mem_map(uint32_t bus, uint32_t size)
+{
+	int fd = open("/dev/mem", O_RDWR|O_SYNC);
+	if (fd < 0) return 0;
+
+	void *virt = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_LOCKED, fd, bus & ~0xc0000000ul);
+	close(fd);
+
+	return virt == MAP_FAILED ? 0 : virt;
+}
+
+void raspi_mem_unmap(void *virt, uint32_t size)
+{
+	munmap(virt, size);
+}
+
+int raspi_mem_alloc(raspi_mem_t *mem, uint32_t size)
+{
+	if (!pHW) return 0;
+
+	uint32_t page = sysconf(_SC_PAGESIZE);
+	size = (size + page - 1) & ~(page - 1);
+
+	// The original Pi has no uncached alias that is coherent with the ARM
+	uint32_t flags = MBOX_MEM_ZERO;
+	if (raspi_arm_io_base == 0x20000000ul) flags |= MBOX_MEM_L1_NONALLOCATING;
+	else flags |= MBOX_MEM_DIRECT;
+
+	mem->handle = mbox_mem_alloc(size, page, flags);
+	if (!mem->handle) return 0;
+
+	mem->bus = mbox_mem_lock(mem->handle);
+	if (mem->bus) {
+		mem->virt = raspi_mem_map(mem->bus, size);
+		if (mem->virt) {
+			mem->size = size;
+			return 1;
+		}
+		mbox_mem_unlock(mem->handle);
+	}
+
+	mbox_mem_release(mem->handle);
+	mem->handle = 0;
+	return 0;
+}
+
+void raspi_mem_free(raspi_mem_t *mem)
+{
+	if (!mem->handle) return;
+
+	raspi_mem_unmap(mem->virt, mem->size);
+	mbox_mem_unlock(mem->handle);
+	mbox_mem_release(mem->handle);
+	mem->handle = 0;
+}
+
+uint32_t raspi_dma_channel_mask(void)
+{
+	uint32_t mask = DMA_CHANNEL_MASK_DEFAULT;
+	uint8_t prop[4];
+
+	int fd = open("/proc/device-tree/soc/dma@7e007000/brcm,dma-channel-mask", O_RDONLY);
+	if (fd < 0) return mask;
+
+	if (read(fd, prop, sizeof(prop)) == sizeof(prop)) {
+		mask = (prop[0]<<24) | (prop[1]<<16) | (prop[2]<<8) | prop[3];
+	}
+	close(fd);
+
+	return mask;
+}
+
+#ifdef RASPI_DIRECTHW_TRACE
+
+#include <stdio.h>
+#include <sys/syscall.h>
+
+static const char *const raspi_trace_names[RASPI_TRACE_USER] = {
+	[RASPI_TRACE_ST_DELAY] = "st_delay",
+	[RASPI_TRACE_SPI_STOP] = "spi_stop",
+	[RASPI_TRACE_SPI_READ] = "spi_read",
+	[RASPI_TRACE_UART0_WRITE] = "uart0_write",
+	[RASPI_TRACE_UART0_FLUSH] = "uart0_flush",
+	[RASPI_TRACE_MBOX_CALL] = "mbox_call",
+	[RASPI_TRACE_SPISL_SYNCHRONIZE] = "spisl_synchronize",
+};
+
+int raspi_trace_dump(const char *path)
+{
+	uint32_t head = raspi_trace_ring.head;
+	uint32_t first = head > RASPI_TRACE_SIZE ? head - RASPI_TRACE_SIZE : 0;
+	long pid = getpid();
+	long tid = syscall(SYS_gettid);
+	uint32_t i;
+
+	FILE *out = fopen(path, "w");
+	if (!out) return 0;
+
+	// System timer ticks are microseconds, just like Chrome trace timestamps
+	fprintf(out, "{\"traceEvents\":[");
+	for (i = first; i != head; i++) {
+		const raspi_trace_record_t *record = &raspi_trace_ring.record[i % RASPI_TRACE_SIZE];
+
+		fprintf(out, "%s\n{\"name\":", i == first ? "" : ",");
+		if (record->id < RASPI_TRACE_USER) fprintf(out, "\"%s\"", raspi_trace_names[record->id]);
+		else fprintf(out, "\"user%u\"", (unsigned)(record->id - RASPI_TRACE_USER));
+		fprintf(out, ",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":%ld,\"tid\":%ld,\"args\":{\"spins\":%u}}",
+				(unsigned)record->start, (unsigned)record->duration, pid, tid, (unsigned)record->spins);
+	}
+	fprintf(out, "\n]}\n");
+
+	return fclose(out) == 0;
+}
+
+#endif
+
 #endif
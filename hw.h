@@ -45,7 +45,13 @@
  * Many registers are specified down to the individual register bit.
  *
  * It also contains helper functions for GPIO and system timer access.
- * `uart.h`, `spi.h`, and `spisl.h` contain more hardware helpers.
+ * `uart.h`, `spi.h`, `spi_aux.h`, `i2c.h`, `spisl.h`, `bscsl.h`, `pwm.h`,
+ * `rng.h`, `clock.h`, `timer.h`, and `gpio_event.h` contain more hardware
+ * helpers, and `gpio.hpp` resolves pins and alternate functions at compile
+ * time for C++.
+ * `dma.h` contains helpers for the DMA controller, which are used by some of
+ * those and by the GPIO waveform generator in `wave.h` and the logic sampler
+ * in `sampler.h`.
  *
  *
  * Usage
@@ -57,8 +63,8 @@
  * efficiently.
  *
  * If running in user mode you need to call `raspi_map_hw()` at the start of
- * your program.  After initialization, @ref HW is the single entry point to all
- * registers.
+ * your program, or `raspi_map_hw_select()` for just the peripherals you need.
+ * After initialization, @ref HW is the single entry point to all registers.
  *
  * **A final warning:** Always use `memory_barrier()` in appropriate places, no
  * matter what you use, API helpers or direct register access.
@@ -91,6 +97,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @defgroup registers Register Declarations
  *
@@ -320,27 +330,94 @@ typedef struct {
  * Auxillary mini SPI 0 (= SPI1). Register names have `AUX_SPI0_` prefix and
  * `_REG` suffix stripped.
  *
- * Unusable due to missing connections.
- *
- *   Signal | Mapping 1
- *  --------|---------------------
- *   SCLK   | GPIO21 Alt4 (S5-11)
- *   MOSI   | GPIO20 Alt4 (nc)
- *   MISO   | GPIO19 Alt4 (nc)
- *   CE0_N  | GPIO18 Alt4 (P1-12)
- *   CE1_N  | GPIO17 Alt4 (P1-11)
- *   CE2_N  | GPIO16 Alt4 (D5)
+ * Unusable on the original boards due to missing connections, but available
+ * on the 40-pin header of later boards.  The register layout follows the Linux
+ * driver, as the datasheet contradicts itself: the data registers are at 0x20
+ * and 0x30, not 0x10.  Note that it needs to be enabled in AUX.ENB.B.SPI1.
+ *
+ *   Signal | Mapping 1           | 40-pin header
+ *  --------|---------------------|--------------
+ *   SCLK   | GPIO21 Alt4 (S5-11) | P1-40
+ *   MOSI   | GPIO20 Alt4 (nc)    | P1-38
+ *   MISO   | GPIO19 Alt4 (nc)    | P1-35
+ *   CE0_N  | GPIO18 Alt4 (P1-12) | P1-12
+ *   CE1_N  | GPIO17 Alt4 (P1-11) | P1-11
+ *   CE2_N  | GPIO16 Alt4 (D5)    | P1-36
  */
 typedef struct {
-	uint32_t CNTL0;
-	uint32_t CNTL1;
-	uint32_t STAT;
-	uint32_t maybe_PEEK;
-	uint32_t IO;
-	uint32_t PEEK; // contradiction in datasheet
-	uint32_t reserved_0x18[2];
-	uint32_t maybe_IO[4];
-	uint32_t maybe_TXHOLD[4];
+	union {
+		uint32_t U;
+		struct raspi_SPI1_CNTL0_reg {
+			/// Number of bits per FIFO entry, 1-32
+			uint32_t SHIFT_LENGTH:6;
+			/// 1: shift out starting with bit 31; 0: with bit 0
+			uint32_t MSB_OUT:1;
+			/// 1: clock idles high
+			uint32_t INVERT_CLK:1;
+			/// 1: change MOSI on rising clock edges
+			uint32_t OUT_RISING:1;
+			/// 1: clear both FIFOs, write 0 again to resume
+			uint32_t CLEAR_FIFOS:1;
+			/// 1: sample MISO on rising clock edges
+			uint32_t IN_RISING:1;
+			uint32_t ENABLE:1;
+			/// Extra system clock cycles MOSI is held: 0, 1, 4 or 7
+			uint32_t DOUT_HOLD:2;
+			/// 1: take shift length from bits 24-28 of each FIFO entry
+			uint32_t VAR_WIDTH:1;
+			/// 1: take chip select pattern from bits 29-31 of each FIFO entry
+			uint32_t VAR_CS:1;
+			/// 1: sample one more bit after the last clock edge
+			uint32_t POST_INPUT:1;
+			/// Pattern on CE0-2 while a transfer is active, 0 = asserted
+			uint32_t CS:3;
+			/// SCLK = system clock / (2 * (SPEED + 1))
+			uint32_t SPEED:12;
+		} B;
+	} CNTL0;
+	union {
+		uint32_t U;
+		struct raspi_SPI1_CNTL1_reg {
+			/// 1: do not clear the receive shift register between entries
+			uint32_t KEEP_INPUT:1;
+			/// 1: received bits enter at bit 0 and move up; 0: the other way
+			uint32_t MSB_IN:1;
+			uint32_t reserved:4;
+			uint32_t DONE_IRQ:1;
+			uint32_t TXE_IRQ:1;
+			/// Extra bit times CS stays high between transfers
+			uint32_t CS_HIGH_TIME:3;
+			uint32_t reserved2:21;
+		} B;
+	} CNTL1;
+	union {
+		uint32_t U;
+		struct raspi_SPI1_STAT_reg {
+			/// Number of bits left to shift
+			uint32_t BIT_COUNT:6;
+			uint32_t BUSY:1;
+			uint32_t RX_EMPTY:1;
+			uint32_t RX_FULL:1;
+			uint32_t TX_EMPTY:1;
+			uint32_t TX_FULL:1;
+			uint32_t reserved:5;
+			/// Number of entries in receive FIFO
+			uint32_t RX_LEVEL:4;
+			uint32_t reserved2:4;
+			/// Number of entries in transmit FIFO
+			uint32_t TX_LEVEL:4;
+			uint32_t reserved3:4;
+		} B;
+	} STAT;
+	/// Oldest entry of the receive FIFO, without removing it
+	uint32_t PEEK;
+	uint32_t reserved_0x10[4];
+	/// Data FIFO: write to send an entry and deassert CS once the transmit
+	/// FIFO has run empty, read to receive an entry.  All four addresses are
+	/// equivalent.
+	uint32_t IO[4];
+	/// Like IO, but CS stays asserted after the entry written here.
+	uint32_t TXHOLD[4];
 } raspi_SPI1_regs;
 /// SPI1 register offset
 #define SPI1_OFFSET 0x215080
@@ -350,7 +427,8 @@ typedef struct {
  * Auxillary mini SPI1 (= SPI2). Register names have `AUX_SPI1_` prefix and
  * `_REG` suffix stripped.
  *
- * Unusable due to missing connections.
+ * Unusable due to missing connections, except on compute modules.  Note that
+ * it needs to be enabled in AUX.ENB.B.SPI2.
  *
  *   Signal | Mapping 1
  *  --------|---------------------
@@ -377,13 +455,49 @@ typedef raspi_SPI1_regs raspi_SPI2_regs;
  *   SCL    | GPIO1 Alt0 (S5-13)  | GPIO29 Alt0 (P5-4) | GPIO45 Alt1 (R27)
  */
 typedef struct {
-	uint32_t C;
-	uint32_t S;
+	union {
+		uint32_t U;
+		struct raspi_BSC_C_reg {
+			uint32_t READ:1;
+			uint32_t reserved_1:3;
+			uint32_t CLEAR:2;
+			uint32_t reserved_6:1;
+			uint32_t ST:1;
+			uint32_t INTD:1;
+			uint32_t INTT:1;
+			uint32_t INTR:1;
+			uint32_t reserved_11:4;
+			uint32_t I2CEN:1;
+			uint32_t reserved:16;
+		} B;
+	} C;
+	union {
+		uint32_t U;
+		struct raspi_BSC_S_reg {
+			uint32_t TA:1;
+			uint32_t DONE:1;
+			uint32_t TXW:1;
+			uint32_t RXR:1;
+			uint32_t TXD:1;
+			uint32_t RXD:1;
+			uint32_t TXE:1;
+			uint32_t RXF:1;
+			uint32_t ERR:1;
+			uint32_t CLKT:1;
+			uint32_t reserved:22;
+		} B;
+	} S;
 	uint32_t DLEN;
 	uint32_t A;
 	uint32_t FIFO;
 	uint32_t DIV;
-	uint32_t DEL;
+	union {
+		uint32_t U;
+		struct raspi_BSC_DEL_reg {
+			uint32_t REDL:16;
+			uint32_t FEDL:16;
+		} B;
+	} DEL;
 	uint32_t CLKT;
 } raspi_BSC0_regs;
 /// BSC0 register offset
@@ -419,10 +533,48 @@ typedef raspi_BSC0_regs raspi_BSC2_regs;
  * DMA control block.
  *
  * This data structure is expected at the address written to CONBLK_AD /
- * NEXTCONBK.
+ * NEXTCONBK.  It must be 32-byte aligned and reside in memory visible to the
+ * DMA engine, see @ref raspi_mem_t.  All addresses are bus addresses.
  */
 typedef struct {
-	uint32_t TI;
+	/// Transfer information
+	union {
+		uint32_t U;
+		struct raspi_DMA_TI_reg {
+			/// Raise interrupt when this control block is finished
+			uint32_t INTEN:1;
+			/// 2D mode: TXFR_LEN is YLENGTH (upper half) times XLENGTH
+			uint32_t TDMODE:1;
+			uint32_t reserved0:1;
+			/// Wait for AXI write response after each write
+			uint32_t WAIT_RESP:1;
+			/// Increment destination address
+			uint32_t DEST_INC:1;
+			/// 1: 128-bit destination writes; 0: 32-bit
+			uint32_t DEST_WIDTH:1;
+			/// Pace destination writes by DREQ of peripheral PERMAP
+			uint32_t DEST_DREQ:1;
+			/// Do not write to the destination
+			uint32_t DEST_IGNORE:1;
+			/// Increment source address
+			uint32_t SRC_INC:1;
+			/// 1: 128-bit source reads; 0: 32-bit
+			uint32_t SRC_WIDTH:1;
+			/// Pace source reads by DREQ of peripheral PERMAP
+			uint32_t SRC_DREQ:1;
+			/// Do not read from the source, write zeros instead
+			uint32_t SRC_IGNORE:1;
+			/// Number of words in a burst, minus one
+			uint32_t BURST_LENGTH:4;
+			/// Peripheral providing DREQ, see @ref raspi_DMA_PERMAP_t
+			uint32_t PERMAP:5;
+			/// Dummy cycles after each read or write
+			uint32_t WAITS:5;
+			/// Prevent wide writes as 2-beat bursts
+			uint32_t NO_WIDE_BURSTS:1;
+			uint32_t reserved1:5;
+		} B;
+	} TI;
 	uint32_t SOURCE_AD;
 	uint32_t DEST_AD;
 	uint32_t TXFR_LEN;
@@ -431,6 +583,27 @@ typedef struct {
 	uint32_t DEBUG; // actually a DMA engine register; ignored in the CB
 	uint32_t reserved_0x1c;
 } raspi_dma_control_block;
+/// Peripherals providing a DREQ signal for [`TI.B.PERMAP`](@ref raspi_dma_control_block).
+typedef enum {
+	DMA_PERMAP_NONE = 0,
+	DMA_PERMAP_DSI = 1,
+	DMA_PERMAP_PCM_TX = 2,
+	DMA_PERMAP_PCM_RX = 3,
+	DMA_PERMAP_SMI = 4,
+	DMA_PERMAP_PWM = 5,
+	DMA_PERMAP_SPI_TX = 6,
+	DMA_PERMAP_SPI_RX = 7,
+	DMA_PERMAP_BSCSL_TX = 8,
+	DMA_PERMAP_BSCSL_RX = 9,
+	DMA_PERMAP_EMMC = 11,
+	DMA_PERMAP_UART_TX = 12,
+	DMA_PERMAP_SDHOST = 13,
+	DMA_PERMAP_UART_RX = 14,
+	DMA_PERMAP_DSI2 = 15,
+	DMA_PERMAP_SLIM_MCTX = 16,
+	DMA_PERMAP_HDMI = 17,
+	DMA_PERMAP_SLIM_MCRX = 18
+} raspi_DMA_PERMAP_t;
 
 
 /**
@@ -439,7 +612,43 @@ typedef struct {
  * No external signals.
  */
 typedef struct {
-	uint32_t CS;
+	/// Control and status
+	union {
+		uint32_t U;
+		struct raspi_DMA_CS_reg {
+			/// Write 1 to start, 0 to pause; reads 0 when finished
+			uint32_t ACTIVE:1;
+			/// Set when a control block with NEXTCONBK == 0 is finished; write 1 to clear
+			uint32_t END:1;
+			/// Interrupt status; write 1 to clear
+			uint32_t INT:1;
+			/// State of the selected DREQ signal
+			uint32_t DREQ:1;
+			/// Channel is paused
+			uint32_t PAUSED:1;
+			/// Channel is paused due to inactive DREQ
+			uint32_t DREQ_STOPS_DMA:1;
+			/// Channel is waiting for the last write to be acknowledged
+			uint32_t WAITING_FOR_OUTSTANDING_WRITES:1;
+			uint32_t reserved0:1;
+			/// An error is flagged in DEBUG
+			uint32_t ERROR:1;
+			uint32_t reserved1:7;
+			/// AXI priority of normal transactions
+			uint32_t PRIORITY:4;
+			/// AXI priority of panicking transactions
+			uint32_t PANIC_PRIORITY:4;
+			uint32_t reserved2:4;
+			/// Wait for outstanding writes before signalling END
+			uint32_t WAIT_FOR_OUTSTANDING_WRITES:1;
+			/// Ignore the debug pause signal
+			uint32_t DISDEBUG:1;
+			/// Write 1 to abort the current control block
+			uint32_t ABORT:1;
+			/// Write 1 to reset the channel
+			uint32_t RESET:1;
+		} B;
+	} CS;
 	uint32_t CONBLK_AD;
 	raspi_dma_control_block CB;
 	uint32_t reserved_0x28[54];
@@ -847,12 +1056,79 @@ typedef struct {
  *   PWM1   | GPIO13 Alt0 (nc) | GPIO19 Alt5 (nc)    | GPIO41 Alt0 (nc)   | GPIO45 Alt0 (S6-L)
  */
 typedef struct {
-	uint32_t CTL;
-	uint32_t STA;
-	uint32_t DMAC;
+	union {
+		uint32_t U;
+		struct raspi_PWM_CTL_reg {
+			/// Channel 1 enable
+			uint32_t PWEN1:1;
+			/// Channel 1 mode; 0: PWM, 1: serializer
+			uint32_t MODE1:1;
+			/// Channel 1 repeats last data when FIFO is empty
+			uint32_t RPTL1:1;
+			/// Channel 1 output level when not transmitting
+			uint32_t SBIT1:1;
+			/// Channel 1 inverted polarity
+			uint32_t POLA1:1;
+			/// Channel 1 takes data from FIFO instead of DAT1
+			uint32_t USEF1:1;
+			/// Write 1 to clear the FIFO
+			uint32_t CLRF1:1;
+			/// Channel 1 M/S mode instead of balanced PWM
+			uint32_t MSEN1:1;
+			/// Channel 2 enable
+			uint32_t PWEN2:1;
+			/// Channel 2 mode; 0: PWM, 1: serializer
+			uint32_t MODE2:1;
+			/// Channel 2 repeats last data when FIFO is empty
+			uint32_t RPTL2:1;
+			/// Channel 2 output level when not transmitting
+			uint32_t SBIT2:1;
+			/// Channel 2 inverted polarity
+			uint32_t POLA2:1;
+			/// Channel 2 takes data from FIFO instead of DAT2
+			uint32_t USEF2:1;
+			uint32_t reserved0:1;
+			/// Channel 2 M/S mode instead of balanced PWM
+			uint32_t MSEN2:1;
+			uint32_t reserved1:16;
+		} B;
+	} CTL;
+	union {
+		uint32_t U;
+		struct raspi_PWM_STA_reg {
+			uint32_t FULL1:1;
+			uint32_t EMPT1:1;
+			uint32_t WERR1:1;
+			uint32_t RERR1:1;
+			uint32_t GAPO1:1;
+			uint32_t GAPO2:1;
+			uint32_t GAPO3:1;
+			uint32_t GAPO4:1;
+			uint32_t BERR:1;
+			uint32_t STA1:1;
+			uint32_t STA2:1;
+			uint32_t STA3:1;
+			uint32_t STA4:1;
+			uint32_t reserved:19;
+		} B;
+	} STA;
+	union {
+		uint32_t U;
+		struct raspi_PWM_DMAC_reg {
+			/// DREQ is active while fewer words are in the FIFO
+			uint32_t DREQ:8;
+			/// Panic is active while fewer words are in the FIFO
+			uint32_t PANIC:8;
+			uint32_t reserved:15;
+			/// DMA enable
+			uint32_t ENAB:1;
+		} B;
+	} DMAC;
+	uint32_t reserved_0x0c;
 	uint32_t RNG1;
 	uint32_t DAT1;
 	uint32_t FIF1;
+	uint32_t reserved_0x1c;
 	uint32_t RNG2;
 	uint32_t DAT2;
 } raspi_PWM_regs;
@@ -943,21 +1219,77 @@ typedef struct {
 /**
  * BSC/SPI slave.
  *
- * Unusable due to missing connections.
+ * Unusable on boards with the 26-pin header due to missing connections.  On
+ * those with the 40-pin header, all signals are available.
  *
  *   Signal   | Mapping 1
- *  ----------|---------------------
- *   SCLK/SCL | GPIO19 Alt3 (nc)
- *   MOSI/SDA | GPIO18 Alt3 (P1-12)
- *   MISO     | GPIO20 Alt3 (nc)
- *   CE_N     | GPIO21 Alt3 (S5-11)
+ *  ----------|-------------------------------------
+ *   SCLK/SCL | GPIO19 Alt3 (nc / J8-35)
+ *   MOSI/SDA | GPIO18 Alt3 (P1-12 / J8-12)
+ *   MISO     | GPIO20 Alt3 (nc / J8-38)
+ *   CE_N     | GPIO21 Alt3 (S5-11 / J8-40)
  */
 typedef struct {
-	uint32_t DR;
-	uint32_t RSR;
+	union {
+		uint32_t U;
+		struct raspi_BSCSL_DR_reg {
+			uint32_t DATA:8;
+			uint32_t OE:1;
+			uint32_t UE:1;
+			uint32_t reserved_10:6;
+			uint32_t TXBUSY:1;
+			uint32_t RXFE:1;
+			uint32_t TXFF:1;
+			uint32_t RXFF:1;
+			uint32_t TXFE:1;
+			uint32_t RXBUSY:1;
+			uint32_t TXFLEVEL:5;
+			uint32_t RXFLEVEL:5;
+		} B;
+	} DR;
+	union {
+		uint32_t U;
+		struct raspi_BSCSL_RSR_reg {
+			uint32_t OE:1;
+			uint32_t UE:1;
+			uint32_t reserved:30;
+		} B;
+	} RSR;
 	uint32_t SLV;
-	uint32_t CR;
-	uint32_t FR;
+	union {
+		uint32_t U;
+		struct raspi_BSCSL_CR_reg {
+			uint32_t EN:1;
+			uint32_t SPI:1;
+			uint32_t I2C:1;
+			uint32_t CPHA:1;
+			uint32_t CPOL:1;
+			uint32_t ENSTAT:1;
+			uint32_t ENCTRL:1;
+			uint32_t BRK:1;
+			uint32_t TXE:1;
+			uint32_t RXE:1;
+			uint32_t INV_RXF:1;
+			uint32_t TESTFIFO:1;
+			uint32_t HOSTCTRLEN:1;
+			uint32_t INV_TXF:1;
+			uint32_t reserved:18;
+		} B;
+	} CR;
+	union {
+		uint32_t U;
+		struct raspi_BSCSL_FR_reg {
+			uint32_t TXBUSY:1;
+			uint32_t RXFE:1;
+			uint32_t TXFF:1;
+			uint32_t RXFF:1;
+			uint32_t TXFE:1;
+			uint32_t RXBUSY:1;
+			uint32_t TXFLEVEL:5;
+			uint32_t RXFLEVEL:5;
+			uint32_t reserved:16;
+		} B;
+	} FR;
 	uint32_t IFLS;
 	uint32_t IMSC;
 	uint32_t RIS;
@@ -1174,7 +1506,15 @@ typedef struct {
 			uint32_t reserved:21;
 		} B;
 	} ICR;
-	uint32_t DMACR; // disabled
+	union {
+		uint32_t U;
+		struct raspi_UART0_DMACR_reg {
+			uint32_t RXDMAE:1;
+			uint32_t TXDMAE:1;
+			uint32_t DMAONERR:1;
+			uint32_t reserved:29;
+		} B;
+	} DMACR; // marked as disabled in the datasheet
 	uint32_t reserved_0x4c[14];
 	union {
 		uint32_t U;
@@ -1474,7 +1814,7 @@ typedef enum {
  * https://github.com/hermanhermitage/videocoreiv/wiki/Register-Documentation
  * and http://magicsmoke.co.za/?p=284
  */
-typedef volatile struct {
+typedef volatile struct raspi_peripherals_struct {
 	/// \cond
 	uint8_t reserved_BEGIN[ST_OFFSET];
 	/// \endcond
@@ -1586,6 +1926,76 @@ extern raspi_peripherals *pHW;
 /// if successful, false on error.
 extern int raspi_map_hw(void);
 
+/// Peripherals to map with raspi_map_hw_select().  Peripherals sharing a page
+/// are mapped together.
+typedef enum {
+	/// System timer
+	RASPI_MAP_ST = 1u << 0,
+	/// DMA channels 0-14 and the global DMA registers
+	RASPI_MAP_DMA = 1u << 1,
+	/// Interrupt controller, ARM timer and mailboxes
+	RASPI_MAP_IRQ = 1u << 2,
+	/// Power management and watchdog
+	RASPI_MAP_PM = 1u << 3,
+	/// Clock manager
+	RASPI_MAP_CM = 1u << 4,
+	/// Random number generator
+	RASPI_MAP_RNG = 1u << 5,
+	/// GPIO, falls back to `/dev/gpiomem` if mapped alone.  Through
+	/// `/dev/mem`, the system timer is always mapped along with it.
+	RASPI_MAP_GPIO = 1u << 6,
+	/// PL011 UART
+	RASPI_MAP_UART0 = 1u << 7,
+	/// MMC controller
+	RASPI_MAP_MMC = 1u << 8,
+	/// PCM/I2S
+	RASPI_MAP_PCM = 1u << 9,
+	/// SPI0 master
+	RASPI_MAP_SPI0 = 1u << 10,
+	/// BSC0 master
+	RASPI_MAP_BSC0 = 1u << 11,
+	/// PWM
+	RASPI_MAP_PWM = 1u << 12,
+	/// BSC/SPI slave
+	RASPI_MAP_BSCSL = 1u << 13,
+	/// Auxiliary peripherals: mini UART, SPI1 and SPI2
+	RASPI_MAP_AUX = 1u << 14,
+	/// EMMC controller
+	RASPI_MAP_EMMC = 1u << 15,
+	/// BSC1 master
+	RASPI_MAP_BSC1 = 1u << 16,
+	/// BSC2 master
+	RASPI_MAP_BSC2 = 1u << 17,
+	/// USB controller
+	RASPI_MAP_USB = 1u << 18,
+	/// DMA channel 15
+	RASPI_MAP_DMA15 = 1u << 19,
+	/// Everything, as mapped by raspi_map_hw()
+	RASPI_MAP_ALL = (1u << 20) - 1
+} raspi_map_t;
+
+/// Map only the pages covering _peripherals_, a combination of
+/// @ref raspi_map_t, into the current user-space process.  This is much faster
+/// than raspi_map_hw() and needs no root privileges if only @ref RASPI_MAP_GPIO
+/// is requested and `/dev/gpiomem` is available.  @ref HW works as usual for
+/// the peripherals mapped, accessing any others raises SIGSEGV.  May be called
+/// repeatedly to map further peripherals.  Return true if all of them are
+/// mapped, false on error.
+///
+/// `/dev/gpiomem` gives access to the GPIO block only.  The system timer then
+/// stays unmapped, so @ref ST_NOW, st_delay() and the helpers based on them
+/// must not be used, see @ref RASPI_ST_MAPPED.  gpio_configure() still works
+/// and times the pull-up/down sequence with a spin loop instead.
+extern int raspi_map_hw_select(uint32_t peripherals);
+
+/// Peripherals currently mapped, a combination of @ref raspi_map_t.  Defined
+/// in hw.c.
+extern uint32_t raspi_hw_mapped;
+
+/// True if the system timer is accessible, which it is not after mapping only
+/// GPIO through `/dev/gpiomem`.
+#define RASPI_ST_MAPPED (raspi_hw_mapped & RASPI_MAP_ST)
+
 #else
 
 /* Bare-metal usage.  This needs compile-time deifnition of either
@@ -1604,13 +2014,16 @@ extern int raspi_map_hw(void);
 #error "You need to select a Raspberry Pi model for bare-metal usage: define either RASPI_DIRECTHW_PI1_ONLY or RASPI_DIRECTHW_PI23_ONLY"
 #endif
 
+#define RASPI_ST_MAPPED 1
+
 #define HW (*(raspi_peripherals *)ARM(0))
 
 #endif
 
-/// Clock frequency in Hz of the APB (Advanced Peripheral Bus).
+/// Default clock frequency in Hz of the APB (Advanced Peripheral Bus).  The
+/// actual rate is obtained with `mbox_clock_rate(MBOX_CLOCK_CORE)` once
+/// `mbox_clock_refresh()` has been called.
 #define CORE_CLOCK 250000000
-// TODO: Dynamically read from clock manager registers where required.
 
 #ifdef __arm__
 
@@ -1632,74 +2045,233 @@ extern int raspi_map_hw(void);
 /// controller and other peripherals.
 #define BUS(x) ((x)+0x7e000000ul)
 
+/// Return the bus address of hardware register _reg_, e.g.
+/// `HW_BUS(HW.SPI0.FIFO)`.  Use this to point DMA transfers at peripherals.
+#define HW_BUS(reg) BUS((uint32_t)((volatile uint8_t *)&(reg) - (volatile uint8_t *)&HW))
+
 /**
- * @defgroup gpio General-Purpose I/O (GPIO)
+ * @defgroup memory DMA Memory
  *
- * Helper functions for configuring and accessing GPIO pins.
+ * Physically contiguous memory that can be accessed by both, the CPU and the
+ * DMA controller.  Caches are bypassed, so no explicit flushing is required.
+ *
+ * In user space, raspi_mem_alloc() obtains such memory from the VideoCore
+ * firmware and maps it into the current process.  For bare-metal usage, fill
+ * in a @ref raspi_mem_t by hand: _virt_ is the physical address and _bus_ is
+ * the physical address ORed with 0xc0000000 (0x40000000 on the original Pi).
+ * The firmware calls behind raspi_mem_alloc() are available as
+ * mbox_mem_alloc() and friends in `mailbox.h`.
+ *
+ * A @ref raspi_arena_t splits one allocation into smaller aligned blocks,
+ * e.g. for control blocks and buffers of a DMA pipeline.
  *
  * Declared in `hw.h`.
  * @{
  */
 
-/// Select between GPIO input, GPIO output, or one of the alternate (peripheral)
-/// functions.
-typedef enum {
-	Input = 0,
-	Output = 1,
-	Alt0 = 4,
-	Alt1 = 5,
-	Alt2 = 6,
-	Alt3 = 7,
-	Alt4 = 3,
-	Alt5 = 2
-} raspi_GPIO_function;
+/// A block of DMA-visible memory.
+typedef struct {
+	/// Address as seen by the CPU
+	void *virt;
+	/// Address as seen by the DMA controller and other peripherals
+	uint32_t bus;
+	/// Size in bytes
+	uint32_t size;
+	/// Firmware memory handle, 0 if not allocated by raspi_mem_alloc()
+	uint32_t handle;
+} raspi_mem_t;
+
+/// Return the bus address of _ptr_, which points into _mem_.
+#define MEM_BUS(mem, ptr) ((mem)->bus + (uint32_t)((uint8_t *)(ptr) - (uint8_t *)(mem)->virt))
 
-/// Select between GPIO pull-up or down
-typedef enum {
-	PullOff = 0,
-	PullDown = 1,
-	PullUp = 2
-} raspi_GPIO_pull;
+#if defined(linux) && !defined(__KERNEL__)
 
+/// Allocate _size_ bytes of uncached, physically contiguous memory via the
+/// firmware and map them into the current process.  Call `raspi_map_hw()`
+/// first.  Return true if successful, false on error.
+extern int raspi_mem_alloc(raspi_mem_t *mem, uint32_t size);
 
-/// Configure GPIO _gpio_ for function _function_.
-static inline void gpio_configure(int gpio, raspi_GPIO_function function, raspi_GPIO_pull pull)
+/// Unmap and release memory allocated with raspi_mem_alloc().
+extern void raspi_mem_free(raspi_mem_t *mem);
+
+/// Map _size_ bytes of memory at bus address _bus_ into the current process,
+/// e.g. memory obtained with mbox_mem_alloc() and mbox_mem_lock().  Return
+/// the virtual address, or NULL on error.
+extern void *raspi_mem_map(uint32_t bus, uint32_t size);
+
+/// Unmap memory mapped with raspi_mem_map().
+extern void raspi_mem_unmap(void *virt, uint32_t size);
+
+#endif
+
+
+/// Arena handing out blocks of a larger @ref raspi_mem_t.
+typedef struct {
+	/// Memory to hand out
+	raspi_mem_t *mem;
+	/// Bytes handed out so far, including alignment padding
+	uint32_t used;
+} raspi_arena_t;
+
+
+/// Initialize _arena_ to hand out blocks of _mem_.
+static inline void raspi_arena_init(raspi_arena_t *arena, raspi_mem_t *mem)
 {
-	static volatile int wait;
-	uint32_t tmp = HW.GPIO.FSEL[gpio/10] & ~(7 << ((gpio%10)*3));
-	HW.GPIO.FSEL[gpio/10] = tmp | (function&7) << ((gpio%10)*3);
-	HW.GPIO.PUD = pull;
-	wait = 150;
-	while (wait--);
-	HW.GPIO.PUDCLK[gpio/32] = 1<<(gpio%32);
-	wait = 150;
-	while (wait--);
-	HW.GPIO.PUDCLK[gpio/32] = 0;
+	arena->mem = mem;
+	arena->used = 0;
 }
 
 
-/// Set (to logical high) GPIO output _gpio_.
-static inline void gpio_set(int gpio)
+/// Take _size_ bytes from _arena_ at a bus address aligned to _align_ bytes (a
+/// power of two, 32 for control blocks) and describe them in _block_, which can
+/// then be used like any other @ref raspi_mem_t.  Return false if the arena is
+/// exhausted.
+static inline int raspi_arena_alloc(raspi_arena_t *arena, uint32_t size, uint32_t align, raspi_mem_t *block)
 {
-	HW.GPIO.SET[gpio/32] = 1<<(gpio%32);
+	uint32_t bus = arena->mem->bus + arena->used;
+	uint32_t offset;
+
+	if (align > 1) bus = (bus + align - 1) & ~(align - 1);
+	offset = bus - arena->mem->bus;
+	if (offset > arena->mem->size || size > arena->mem->size - offset) return 0;
+
+	block->virt = (uint8_t *)arena->mem->virt + offset;
+	block->bus = bus;
+	block->size = size;
+	block->handle = 0;
+	arena->used = offset + size;
+	return 1;
 }
 
 
-/// Clear (set to logical low) GPIO output _gpio_.
-static inline void gpio_clear(int gpio)
+/// Return all blocks to _arena_.  None of them may be in use.
+static inline void raspi_arena_reset(raspi_arena_t *arena)
 {
-	HW.GPIO.CLR[gpio/32] = 1<<(gpio%32);
+	arena->used = 0;
 }
 
+/**
+ * @}
+ */
+
+/**
+ * @defgroup trace Tracing
+ *
+ * Optional recording of the time spent in blocking primitives, to find out
+ * where a real-time loop lost its time.  Define `RASPI_DIRECTHW_TRACE` for all
+ * source files, including the one with `hw.c`, to enable it.  Otherwise the
+ * macros below expand to nothing.
+ *
+ * Each call of an instrumented primitive, e.g. st_delay(), spi_stop() or
+ * mbox_call_bus(), records its start time, duration and the number of
+ * iterations spent spinning on a register.  Records go into a ring buffer of
+ * the calling thread, so recording takes no locks.  Once full, the oldest
+ * records are overwritten.  Use `RASPI_TRACE_BEGIN(RASPI_TRACE_USER + n)` and
+ * `RASPI_TRACE_END(RASPI_TRACE_USER + n)` to add sections of your own.
+ *
+ * In user space, raspi_trace_dump() writes the records of the calling thread
+ * in the Chrome trace event format, which can be viewed with Perfetto or
+ * `chrome://tracing`.  It cannot see the rings of other threads, so each
+ * traced thread must dump its own records, e.g. before it exits.  Files of
+ * several threads can be opened together; events carry the thread id.
+ *
+ * Declared in `hw.h`.
+ * @{
+ */
+
 
-/// Return true (but not neccessarily 1) if GPIO input _gpio_ is driven high.
-static inline uint32_t gpio_read(int gpio)
+/// Traced primitives.
+typedef enum {
+	RASPI_TRACE_ST_DELAY,
+	RASPI_TRACE_SPI_STOP,
+	RASPI_TRACE_SPI_READ,
+	RASPI_TRACE_UART0_WRITE,
+	RASPI_TRACE_UART0_FLUSH,
+	RASPI_TRACE_MBOX_CALL,
+	RASPI_TRACE_SPISL_SYNCHRONIZE,
+	/// First identifier available to applications
+	RASPI_TRACE_USER
+} raspi_trace_id_t;
+
+
+#ifdef RASPI_DIRECTHW_TRACE
+
+#ifndef RASPI_TRACE_SIZE
+/// Number of records per thread.  Must be a power of two.
+#define RASPI_TRACE_SIZE 4096
+#endif
+
+/// A single call of a traced primitive.
+typedef struct {
+	/// A @ref raspi_trace_id_t
+	uint32_t id;
+	/// System timer timestamp of entry
+	uint32_t start;
+	/// Ticks until exit
+	uint32_t duration;
+	/// Spin loop iterations
+	uint32_t spins;
+} raspi_trace_record_t;
+
+/// Records of one thread.
+typedef struct {
+	raspi_trace_record_t record[RASPI_TRACE_SIZE];
+	/// Number of records written
+	uint32_t head;
+} raspi_trace_ring_t;
+
+#if defined(linux) && !defined(__KERNEL__)
+#define RASPI_TRACE_THREAD __thread
+#else
+#define RASPI_TRACE_THREAD /**/
+#endif
+
+/// Trace ring of the current thread.  Defined in hw.c.
+extern RASPI_TRACE_THREAD raspi_trace_ring_t raspi_trace_ring;
+
+/// Store a record in the current thread's ring.
+static inline void raspi_trace_record(uint32_t id, uint32_t start, uint32_t end, uint32_t spins)
 {
-	return HW.GPIO.LEV[gpio/32] & (1<<(gpio%32));
+	raspi_trace_record_t *record = &raspi_trace_ring.record[raspi_trace_ring.head++ % RASPI_TRACE_SIZE];
+
+	record->id = id;
+	record->start = start;
+	record->duration = end - start;
+	record->spins = spins;
 }
 
+/// Start a traced section with identifier _id_ in the current scope.
+#define RASPI_TRACE_BEGIN(id) \
+	uint32_t raspi_trace_spins = 0; \
+	uint32_t raspi_trace_start = RASPI_ST_MAPPED ? HW.ST.CLO : 0
+
+/// Count one iteration of a spin loop in the current traced section.
+#define RASPI_TRACE_SPIN() (raspi_trace_spins++)
+
+/// End the traced section with identifier _id_.
+#define RASPI_TRACE_END(id) \
+	raspi_trace_record((id), raspi_trace_start, RASPI_ST_MAPPED ? HW.ST.CLO : 0, raspi_trace_spins)
+
+#if defined(linux) && !defined(__KERNEL__)
+/// Write the records of the current thread to the file _path_ as Chrome trace
+/// JSON.  Return true on success.  Records of other threads are not included,
+/// so call this from every thread of interest, each with its own _path_.
+extern int raspi_trace_dump(const char *path);
+#endif
+
+#else
+
+#define RASPI_TRACE_BEGIN(id) /**/
+#define RASPI_TRACE_SPIN() /**/
+#define RASPI_TRACE_END(id) /**/
+
+#endif
+
 /**
  * @}
+ */
+
+/**
  * @defgroup systimer System Timer
  * Utility functions for measuring time and busy-waiting short amounts of time.
  *
@@ -1716,11 +2288,32 @@ typedef uint32_t st_time_t;
 typedef uint32_t st_delta_t;
 
 
+/// Type for full 64 bit system timer time stamps, which do not wrap in
+/// practice.  32 bit time stamps wrap after about 71 minutes.
+typedef uint64_t st_time64_t;
+
+
 /// Return current system timer timestamp.  It measures time independent of
 /// clock scaling.
 #define ST_NOW ((st_time_t)HW.ST.CLO)
 
 
+/// Return the current 64 bit system timer timestamp.  The upper half is read
+/// again until it is stable, so the result is consistent even when the lower
+/// half wraps between the reads.
+static inline st_time64_t st_now64(void)
+{
+	uint32_t hi, lo;
+
+	do {
+		hi = HW.ST.CHI;
+		lo = HW.ST.CLO;
+	} while (HW.ST.CHI != hi);
+
+	return (st_time64_t)hi << 32 | lo;
+}
+
+
 /// System timer frequency in Hz (== timer ticks in 1 s)
 #define ST_1s ((st_delta_t)1000000)
 
@@ -1741,15 +2334,238 @@ static inline int st_elapsed(st_time_t before, st_time_t after, st_delta_t diff)
 }
 
 
-/// Busy-wait for the given _delay_.
+/// Busy-wait for the given _delay_.  See st_sleep() in `timer.h` for longer
+/// delays.
 static inline void st_delay(st_delta_t delay)
 {
+	RASPI_TRACE_BEGIN(RASPI_TRACE_ST_DELAY);
 	st_time_t start = ST_NOW;
-	while (!st_elapsed(start, ST_NOW, delay));
+	while (!st_elapsed(start, ST_NOW, delay)) RASPI_TRACE_SPIN();
+	RASPI_TRACE_END(RASPI_TRACE_ST_DELAY);
 }
 
 /**
  * @}
+ * @defgroup gpio General-Purpose I/O (GPIO)
+ *
+ * Helper functions for configuring and accessing GPIO pins.
+ *
+ * Declared in `hw.h`.
+ * @{
  */
 
+/// Select between GPIO input, GPIO output, or one of the alternate (peripheral)
+/// functions.
+typedef enum {
+	Input = 0,
+	Output = 1,
+	Alt0 = 4,
+	Alt1 = 5,
+	Alt2 = 6,
+	Alt3 = 7,
+	Alt4 = 3,
+	Alt5 = 2
+} raspi_GPIO_function;
+
+/// Select between GPIO pull-up or down
+typedef enum {
+	PullOff = 0,
+	PullDown = 1,
+	PullUp = 2
+} raspi_GPIO_pull;
+
+
+/// Return the bank (0: GPIO0-31, 1: GPIO32-53) of GPIO _gpio_.
+#define GPIO_BANK(gpio) ((gpio)/32)
+
+/// Return the bit mask of GPIO _gpio_ within its bank.
+#define GPIO_BIT(gpio) (1u<<((gpio)%32))
+
+
+/// Time to hold the pull-up/down control signals before and after clocking
+/// them into the GPIOs.  The datasheet requires 150 cycles.  Two system timer
+/// ticks guarantee at least 1 µs, which is sufficient for clock rates down to
+/// 150 MHz.
+#define GPIO_PUD_DELAY (2*ST_1us)
+
+/// Iterations of the spin loop replacing @ref GPIO_PUD_DELAY while the system
+/// timer is not mapped.  Each takes at least one ARM cycle, so this covers 150
+/// core cycles for ARM clocks up to 26 times the core clock.
+#define GPIO_PUD_SPINS 4000
+
+
+#ifdef RASPI_DIRECTHW_SMP
+
+/// Locks serializing the read-modify-write cycles on each FSEL register and
+/// the pull-up/down sequence, if `RASPI_DIRECTHW_SMP` is defined.  These live
+/// in memory rather than on the registers, since exclusive accesses do not
+/// work on peripherals.  Defined in hw.c.
+extern volatile uint32_t gpio_fsel_lock[6];
+/// See @ref gpio_fsel_lock.
+extern volatile uint32_t gpio_pud_lock;
+
+/// Acquire spin lock _lock_.
+static inline void raspi_spin_lock(volatile uint32_t *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED));
+	}
+}
+
+/// Release spin lock _lock_.
+static inline void raspi_spin_unlock(volatile uint32_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#define GPIO_LOCK(lock) raspi_spin_lock(&(lock))
+#define GPIO_UNLOCK(lock) raspi_spin_unlock(&(lock))
+
+#else
+
+/// Acquire a GPIO configuration lock if `RASPI_DIRECTHW_SMP` is defined.
+/// Otherwise, GPIO configuration from several threads or cores at once must
+/// be serialized by the application.
+#define GPIO_LOCK(lock) /**/
+/// Release a GPIO configuration lock if `RASPI_DIRECTHW_SMP` is defined.
+#define GPIO_UNLOCK(lock) /**/
+
+#endif
+
+
+/// Wait @ref GPIO_PUD_DELAY, or spin @ref GPIO_PUD_SPINS times if the system
+/// timer is not mapped.
+static inline void gpio_pud_delay(void)
+{
+	volatile uint32_t spin;
+
+	if (RASPI_ST_MAPPED) {
+		st_delay(GPIO_PUD_DELAY);
+		return;
+	}
+	for (spin = 0; spin < GPIO_PUD_SPINS; spin++);
+}
+
+
+/// Set pull-up/down _pull_ for all GPIOs in bank _bank_ whose bits are set in
+/// _mask_, using a single clock pulse.  Timing is based on the system timer,
+/// so it does not depend on the CPU clock, unless the system timer is not
+/// mapped.
+static inline void gpio_pull_mask(int bank, uint32_t mask, raspi_GPIO_pull pull)
+{
+	if (!mask) return;
+
+	GPIO_LOCK(gpio_pud_lock);
+	HW.GPIO.PUD = pull;
+	memory_barrier();
+	gpio_pud_delay();
+	memory_barrier();
+	HW.GPIO.PUDCLK[bank] = mask;
+	memory_barrier();
+	gpio_pud_delay();
+	memory_barrier();
+	HW.GPIO.PUD = PullOff;
+	HW.GPIO.PUDCLK[bank] = 0;
+	GPIO_UNLOCK(gpio_pud_lock);
+}
+
+
+/// Configure all GPIOs in bank _bank_ whose bits are set in _mask_ for
+/// function _function_ and pull-up/down _pull_.  Each function select register
+/// is written once, and the pull-up/down sequence is executed once for all
+/// GPIOs.
+static inline void gpio_configure_mask(int bank, uint32_t mask, raspi_GPIO_function function, raspi_GPIO_pull pull)
+{
+	int reg;
+
+	for (reg = bank*32/10; reg <= (bank*32+31)/10 && reg < 6; reg++) {
+		uint32_t clear = 0;
+		uint32_t set = 0;
+		int i;
+
+		for (i = 0; i < 10; i++) {
+			int gpio = reg*10 + i;
+			if (GPIO_BANK(gpio) != bank || !(mask & GPIO_BIT(gpio))) continue;
+			clear |= 7 << (i*3);
+			set |= (function&7) << (i*3);
+		}
+
+		if (!clear) continue;
+		GPIO_LOCK(gpio_fsel_lock[reg]);
+		HW.GPIO.FSEL[reg] = (HW.GPIO.FSEL[reg] & ~clear) | set;
+		GPIO_UNLOCK(gpio_fsel_lock[reg]);
+	}
+
+	gpio_pull_mask(bank, mask, pull);
+}
+
+
+/// Configure GPIO _gpio_ for function _function_.
+static inline void gpio_configure(int gpio, raspi_GPIO_function function, raspi_GPIO_pull pull)
+{
+	gpio_configure_mask(GPIO_BANK(gpio), GPIO_BIT(gpio), function, pull);
+}
+
+
+/// Set (to logical high) GPIO output _gpio_.
+static inline void gpio_set(int gpio)
+{
+	HW.GPIO.SET[gpio/32] = 1<<(gpio%32);
+}
+
+
+/// Clear (set to logical low) GPIO output _gpio_.
+static inline void gpio_clear(int gpio)
+{
+	HW.GPIO.CLR[gpio/32] = 1<<(gpio%32);
+}
+
+
+/// Return true (but not neccessarily 1) if GPIO input _gpio_ is driven high.
+static inline uint32_t gpio_read(int gpio)
+{
+	return HW.GPIO.LEV[gpio/32] & (1<<(gpio%32));
+}
+
+
+/// Set (to logical high) all GPIO outputs in bank _bank_ whose bits are set in
+/// _mask_, using a single register write.
+static inline void gpio_set_mask(int bank, uint32_t mask)
+{
+	HW.GPIO.SET[bank] = mask;
+}
+
+
+/// Clear (set to logical low) all GPIO outputs in bank _bank_ whose bits are
+/// set in _mask_, using a single register write.
+static inline void gpio_clear_mask(int bank, uint32_t mask)
+{
+	HW.GPIO.CLR[bank] = mask;
+}
+
+
+/// Drive all GPIO outputs in bank _bank_ whose bits are set in _mask_ to the
+/// corresponding bits of _value_.  Outputs going high change one register
+/// write before those going low.
+static inline void gpio_write_mask(int bank, uint32_t mask, uint32_t value)
+{
+	HW.GPIO.SET[bank] = value & mask;
+	HW.GPIO.CLR[bank] = ~value & mask;
+}
+
+
+/// Return the levels of all GPIOs in bank _bank_, one bit per GPIO.
+static inline uint32_t gpio_read_bank(int bank)
+{
+	return HW.GPIO.LEV[bank];
+}
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,291 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup i2c I2C Master (BSC0/BSC1)
+ *
+ * These functions allow direct access to the Raspberry Pi's BSC (I2C) master
+ * peripherals without using the regular Linux device driver.  This is useful
+ * when running under Xenomai or a similar real-time OS.  Note that you *must*
+ * unload the I2C kernel module, or these functions will not work correctly.
+ *
+ * _bus_ selects BSC0 (0, GPIO0/1) or BSC1 (1, GPIO2/3, the I2C bus on the
+ * P1 header of all but the earliest boards).  Addresses are 7 bit.
+ *
+ * The BSC masters have no DREQ signal, so transfers cannot be paced by DMA.
+ * Instead, the FIFO is filled and drained in bursts, based on a single status
+ * register read each.
+ *
+ * Declared in `i2c.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_I2C_H
+#define RASPI_DIRECTHW_I2C_H
+
+#include "hw.h"
+#include "mailbox.h"
+
+/// Size of the FIFO, which is shared by both directions.
+#define raspi_BSC_FIFOSIZE 16
+
+/// Maximum number of bytes per transfer, limited by the DLEN register.
+#define raspi_BSC_MAXLEN 65535
+
+
+/// Return the registers of BSC master _bus_ (0 or 1).
+static inline volatile raspi_BSC0_regs *i2c_regs(int bus)
+{
+	if (bus == 0) return &HW.BSC0;
+	return &HW.BSC1;
+}
+
+
+/// Configure BSC master _bus_ for _speed_ Hz SCL, based on the cached core
+/// clock.  Return the SCL frequency actually achieved, which never exceeds
+/// _speed_, or 0 if _speed_ is 0.
+static inline uint32_t i2c_init(int bus, uint32_t speed)
+{
+	volatile raspi_BSC0_regs *bsc = i2c_regs(bus);
+	uint32_t core = mbox_clock_rate(MBOX_CLOCK_CORE);
+	struct raspi_BSC_DEL_reg del;
+	uint32_t div;
+
+	const struct raspi_BSC_C_reg enable = {
+		.I2CEN = 1,
+		.CLEAR = 1,
+	};
+
+	const struct raspi_BSC_S_reg status = {
+		.DONE = 1,
+		.ERR = 1,
+		.CLKT = 1,
+	};
+
+	if (!speed) return 0;
+
+	// the divider is always rounded down to an even number
+	div = (core + speed - 1) / speed;
+	div += div & 1;
+	if (div < 2) div = 2;
+	if (div > 65534) div = 65534;
+
+	// sample and drive SDA well away from the SCL edges
+	del.FEDL = div / 16 ? div / 16 : 1;
+	del.REDL = div / 4 ? div / 4 : 1;
+
+	gpio_configure_mask(0, 3u << (2*!!bus), Alt0, PullUp);
+	memory_barrier();
+
+	bsc->C.U = 0;
+	bsc->DIV = div;
+	bsc->DEL.B = del;
+	bsc->S.B = status;
+	bsc->C.B = enable;
+	memory_barrier();
+
+	return core / div;
+}
+
+
+/// Clear FIFO and status flags of _bsc_ and set up a transfer of _len_ bytes
+/// for slave _addr_.
+static inline void i2c_prepare(volatile raspi_BSC0_regs *bsc, uint8_t addr, uint32_t len)
+{
+	const struct raspi_BSC_C_reg clear = {
+		.I2CEN = 1,
+		.CLEAR = 1,
+	};
+
+	const struct raspi_BSC_S_reg status = {
+		.DONE = 1,
+		.ERR = 1,
+		.CLKT = 1,
+	};
+
+	memory_barrier();
+	bsc->C.B = clear;
+	bsc->S.B = status;
+	bsc->A = addr;
+	bsc->DLEN = len;
+}
+
+
+/// Block until the transfer on _bsc_ has ended and reset the FIFO.  Return
+/// false if the slave did not acknowledge or stretched SCL beyond the timeout.
+static inline int i2c_finish(volatile raspi_BSC0_regs *bsc)
+{
+	struct raspi_BSC_S_reg s;
+
+	const struct raspi_BSC_C_reg clear = {
+		.I2CEN = 1,
+		.CLEAR = 1,
+	};
+
+	const struct raspi_BSC_S_reg status = {
+		.DONE = 1,
+		.ERR = 1,
+		.CLKT = 1,
+	};
+
+	do {
+		s = bsc->S.B;
+	} while (!s.DONE && !s.ERR && !s.CLKT);
+
+	bsc->C.B = clear;
+	bsc->S.B = status;
+	memory_barrier();
+	return !s.ERR && !s.CLKT;
+}
+
+
+/// Receive _len_ bytes into _rx_ for the read transfer started on _bsc_, then
+/// finish it.  Return false on error.
+static inline int i2c_receive(volatile raspi_BSC0_regs *bsc, uint8_t *rx, uint32_t len)
+{
+	uint32_t received = 0;
+
+	while (received < len) {
+		struct raspi_BSC_S_reg s = bsc->S.B;
+		uint32_t num;
+
+		// Read as many bytes as the FIFO is known to hold
+		if (s.RXF) num = raspi_BSC_FIFOSIZE;
+		else if (s.RXR) num = raspi_BSC_FIFOSIZE*3/4;
+		else num = s.RXD;
+		if (!num && (s.DONE || s.ERR || s.CLKT)) break;
+		if (num > len - received) num = len - received;
+
+		for (; num; num--, received++) rx[received] = bsc->FIFO;
+	}
+
+	return i2c_finish(bsc) && received == len;
+}
+
+
+/// Send _len_ bytes from _tx_ to slave _addr_ on _bus_.  Block until done.
+/// Return false if the slave did not acknowledge, on timeout, or if _len_
+/// exceeds @ref raspi_BSC_MAXLEN.
+static inline int i2c_write(int bus, uint8_t addr, const uint8_t *tx, uint32_t len)
+{
+	volatile raspi_BSC0_regs *bsc = i2c_regs(bus);
+	uint32_t sent = 0;
+
+	const struct raspi_BSC_C_reg start = {
+		.I2CEN = 1,
+		.ST = 1,
+	};
+
+	if (len > raspi_BSC_MAXLEN) return 0;
+
+	i2c_prepare(bsc, addr, len);
+	for (; sent < len && sent < raspi_BSC_FIFOSIZE; sent++) bsc->FIFO = tx[sent];
+	bsc->C.B = start;
+
+	while (sent < len) {
+		struct raspi_BSC_S_reg s = bsc->S.B;
+		uint32_t num;
+
+		if (s.ERR || s.CLKT) break;
+
+		// Write as many bytes as the FIFO is known to accept
+		if (s.TXE) num = raspi_BSC_FIFOSIZE;
+		else if (s.TXW) num = raspi_BSC_FIFOSIZE*3/4;
+		else num = s.TXD;
+		if (num > len - sent) num = len - sent;
+
+		for (; num; num--, sent++) bsc->FIFO = tx[sent];
+	}
+
+	return i2c_finish(bsc);
+}
+
+
+/// Receive _len_ bytes from slave _addr_ on _bus_ into _rx_.  Block until
+/// done.  Return false as for i2c_write().
+static inline int i2c_read(int bus, uint8_t addr, uint8_t *rx, uint32_t len)
+{
+	volatile raspi_BSC0_regs *bsc = i2c_regs(bus);
+
+	const struct raspi_BSC_C_reg start = {
+		.I2CEN = 1,
+		.ST = 1,
+		.READ = 1,
+	};
+
+	if (len > raspi_BSC_MAXLEN) return 0;
+
+	i2c_prepare(bsc, addr, len);
+	bsc->C.B = start;
+	return i2c_receive(bsc, rx, len);
+}
+
+
+/// Send _txlen_ bytes from _tx_ to slave _addr_ on _bus_, then receive _rxlen_
+/// bytes into _rx_ after a repeated start condition, as required for reading
+/// registers of most sensors.  _txlen_ must be between 1 and
+/// @ref raspi_BSC_FIFOSIZE.  Block until done.  Return false as for
+/// i2c_write().
+static inline int i2c_write_read(int bus, uint8_t addr, const uint8_t *tx, uint32_t txlen, uint8_t *rx, uint32_t rxlen)
+{
+	volatile raspi_BSC0_regs *bsc = i2c_regs(bus);
+	struct raspi_BSC_S_reg s;
+	uint32_t i;
+
+	const struct raspi_BSC_C_reg start_write = {
+		.I2CEN = 1,
+		.ST = 1,
+	};
+
+	const struct raspi_BSC_C_reg start_read = {
+		.I2CEN = 1,
+		.ST = 1,
+		.READ = 1,
+	};
+
+	const struct raspi_BSC_S_reg done = {
+		.DONE = 1,
+	};
+
+	if (!txlen || txlen > raspi_BSC_FIFOSIZE || rxlen > raspi_BSC_MAXLEN) return 0;
+
+	i2c_prepare(bsc, addr, txlen);
+	for (i = 0; i < txlen; i++) bsc->FIFO = tx[i];
+	bsc->C.B = start_write;
+
+	// Once the write is under way, queue the read.  The controller then
+	// issues a repeated start instead of a stop condition.
+	do {
+		s = bsc->S.B;
+	} while (!s.TA && !s.DONE);
+	if (s.ERR || s.CLKT) return i2c_finish(bsc);
+
+	bsc->DLEN = rxlen;
+	bsc->S.B = done;
+	bsc->C.B = start_read;
+	return i2c_receive(bsc, rx, rxlen);
+}
+
+#endif
+
+///@}
@@ -60,8 +60,15 @@ typedef enum {
 	MBOX_TAG_GET_FIRMWARE = 0x00000001,
 	// TODO
 	MBOX_TAG_GET_CLOCK_STATE = 0x00030001,
+	MBOX_TAG_ALLOCATE_MEMORY = 0x0003000c,
+	MBOX_TAG_LOCK_MEMORY = 0x0003000d,
+	MBOX_TAG_UNLOCK_MEMORY = 0x0003000e,
+	MBOX_TAG_RELEASE_MEMORY = 0x0003000f,
 	MBOX_TAG_GET_CLOCK_RATE = 0x00030002,
 	MBOX_TAG_GET_CLOCK_RATE_MEASURED = 0x00030047,
+	MBOX_TAG_GET_TEMPERATURE = 0x00030006,
+	MBOX_TAG_GET_MAX_TEMPERATURE = 0x0003000a,
+	MBOX_TAG_GET_THROTTLED = 0x00030046,
 	MBOX_TAG_SET_CLOCK_STATE = 0x00038001,
 	MBOX_TAG_SET_CLOCK_RATE = 0x00038002
 } mbox_tag_t;
@@ -78,18 +85,44 @@ static inline uint32_t mbox_read() {
 	return HW.MBOX0.DATA;
 }
 
-static inline void mbox_call(raspi_MBOX_CHANNEL_t chan, void *addr) {
-	uint32_t wanted = chan | (intptr_t)addr;
+/// Send bus address _bus_ to channel _chan_ and block until the firmware
+/// returns it.  Replies to other requests are discarded, so do not mix with
+/// the @ref mbox_async_t calls while those are in flight.
+static inline void mbox_call_bus(raspi_MBOX_CHANNEL_t chan, uint32_t bus) {
+	uint32_t wanted = chan | bus;
+	RASPI_TRACE_BEGIN(RASPI_TRACE_MBOX_CALL);
 
-	while (HW.MBOX0.STATUS_FULL);
+	while (HW.MBOX0.STATUS_FULL) RASPI_TRACE_SPIN();
 	HW.MBOX1.DATA = wanted;
 
 	do {
 		memory_barrier();
-		while (HW.MBOX0.STATUS_EMPTY);
+		while (HW.MBOX0.STATUS_EMPTY) RASPI_TRACE_SPIN();
 	} while (HW.MBOX0.DATA != wanted);
+	RASPI_TRACE_END(RASPI_TRACE_MBOX_CALL);
+}
+
+/// Same as mbox_call_bus() for a buffer whose virtual address equals its bus
+/// address, which only holds in bare metal environments.
+static inline void mbox_call(raspi_MBOX_CHANNEL_t chan, void *addr) {
+	mbox_call_bus(chan, (intptr_t)addr);
 }
 
+#if defined(linux) && !defined(__KERNEL__)
+/// Send the property buffer _buf_ through the kernel's mailbox driver and
+/// return true on success.  `/dev/vcio` is opened on the first call and stays
+/// open until raspi_vcio_close().  Defined in hw.c.
+extern int raspi_vcio_call(void *buf);
+
+/// Close `/dev/vcio` once no more property calls are due, e.g. at program
+/// exit.  A later call reopens it.  Defined in hw.c.
+extern void raspi_vcio_close(void);
+
+#define mbox_property_send(mbox) raspi_vcio_call(&mbox)
+#else
+#define mbox_property_send(mbox) mbox_call(MBOX_CH_PROPVC, &mbox)
+#endif
+
 #define mbox_property_struct(size) \
 	struct { \
 		mbox_property_header_t header; \
@@ -98,21 +131,44 @@ static inline void mbox_call(raspi_MBOX_CHANNEL_t chan, void *addr) {
 		uint32_t end; \
 	}
 
-#define mbox_property_call(tagid, mbox) \
+#define mbox_property_init(tagid, mbox) \
 	mbox.header.buffer_size = sizeof(mbox); \
 	mbox.header.code = PROP_REQUEST; \
 	mbox.tag.tag = tagid; \
 	mbox.tag.buffer_size = sizeof(mbox.data); \
 	mbox.tag.response_length = sizeof(mbox.data); \
 	mbox.tag.has_response = 0; \
-	mbox.end = 0; \
-	mbox_call(MBOX_CH_PROPVC, &mbox);
+	mbox.end = 0;
+
+#define mbox_property_call(tagid, mbox) \
+	mbox_property_init(tagid, mbox) \
+	mbox_property_send(mbox);
 
 #define mbox_property_call_multi(mbox) \
 	mbox.header.buffer_size = sizeof(mbox); \
 	mbox.header.code = PROP_REQUEST; \
 	mbox.end = 0; \
-	mbox_call(MBOX_CH_PROPVC, &mbox);
+	mbox_property_send(mbox);
+
+/// flags for MBOX_TAG_ALLOCATE_MEMORY
+typedef enum {
+	/// can be resized to 0 at any time; use for cached data
+	MBOX_MEM_DISCARDABLE = 1 << 0,
+	/// normal allocating alias; don't use from ARM
+	MBOX_MEM_NORMAL = 0 << 2,
+	/// 0xC alias: uncached
+	MBOX_MEM_DIRECT = 1 << 2,
+	/// 0x8 alias: non-allocating in L2 but coherent
+	MBOX_MEM_COHERENT = 2 << 2,
+	/// allocating in L2, non-allocating in L1
+	MBOX_MEM_L1_NONALLOCATING = MBOX_MEM_DIRECT | MBOX_MEM_COHERENT,
+	/// initialise buffer to all zeros
+	MBOX_MEM_ZERO = 1 << 4,
+	/// don't initialise (default is initialise to all ones)
+	MBOX_MEM_NO_INIT = 1 << 5,
+	/// likely to be locked for long periods of time
+	MBOX_MEM_HINT_PERMALOCK = 1 << 6,
+} mbox_mem_flag_t;
 
 /// clocks settable via mailbox property API
 typedef enum {
@@ -133,40 +189,552 @@ typedef enum {
 	MBOX_CLOCK_PIXEL_BVB,
 } mbox_property_clock_t;
 
+/// Number of entries in @ref mbox_property_clock_t.
+#define MBOX_CLOCK_COUNT (MBOX_CLOCK_PIXEL_BVB + 1)
 
-static inline void mbox_set_clock(mbox_property_clock_t clock, uint32_t freq) {
-	mbox_property_struct(3) mbox;
-	mbox.data[0] = clock;
-	mbox.data[1] = 1;
-	mbox_property_call(MBOX_TAG_SET_CLOCK_STATE, mbox);
 
-	mbox.data[0] = clock;
-	mbox.data[1] = freq;
-	mbox.data[2] = 0;
-	mbox_property_call(MBOX_TAG_SET_CLOCK_RATE, mbox);
+/**
+ * @name Batched property calls
+ *
+ * A batch packs any number of tags into a single property request, which
+ * the firmware processes in one mailbox transaction.  The request lives in a
+ * caller-provided @ref raspi_mem_t, which may be kept across calls, e.g. for
+ * periodic health polling.  Each tag function returns a pointer to the tag's
+ * value buffer, which holds the response after mbox_batch_call(), or NULL if
+ * the batch is full.
+ *
+ * In bare metal environments, the buffer must be uncached and _bus_ its bus
+ * address, see @ref memory.  In Linux user space, the kernel's mailbox driver
+ * owns the reply interrupt, so the request is submitted via `/dev/vcio`
+ * instead and any memory will do.
+ *
+ * @{
+ */
+
+/// Property request under construction.
+typedef struct {
+	/// Virtual address of the request
+	volatile uint32_t *buf;
+	/// Bus address of the request
+	uint32_t bus;
+	/// Capacity in words
+	uint32_t size;
+	/// Words used so far
+	uint32_t pos;
+} mbox_batch_t;
+
+/// Declare the batch _name_ with a buffer of _words_ words on the stack.
+#define MBOX_BATCH(name, words) \
+	uint32_t name##_words[words] __attribute__((aligned(16))); \
+	raspi_mem_t name##_mem = { name##_words, (uint32_t)(intptr_t)name##_words, sizeof(name##_words), 0 }; \
+	mbox_batch_t name; \
+	mbox_batch_init(&name, &name##_mem)
+
+
+/// Start an empty batch in _mem_.  Return false if _mem_ is too small.
+static inline int mbox_batch_init(mbox_batch_t *batch, const raspi_mem_t *mem)
+{
+	batch->buf = (volatile uint32_t *)mem->virt;
+	batch->bus = mem->bus;
+	batch->size = mem->virt ? mem->size / 4 : 0;
+	batch->pos = 2;
+	return batch->size >= 3;
+}
+
+
+/// Append tag _tag_ with a value buffer of _words_ words, all zero.  Return
+/// the value buffer, or NULL if the batch is full.
+static inline volatile uint32_t *mbox_batch_add(mbox_batch_t *batch, mbox_tag_t tag, uint32_t words)
+{
+	volatile uint32_t *value;
+	uint32_t i;
+
+	// tag header, value buffer and end tag
+	if (batch->pos + 3 + words + 1 > batch->size) return 0;
+
+	batch->buf[batch->pos++] = tag;
+	batch->buf[batch->pos++] = 4 * words;
+	batch->buf[batch->pos++] = 0;
+	value = &batch->buf[batch->pos];
+	for (i = 0; i < words; i++) value[i] = 0;
+	batch->pos += words;
+	return value;
+}
+
+
+/// Return true if the firmware has answered the tag with value buffer _value_.
+static inline int mbox_batch_ok(const volatile uint32_t *value)
+{
+	return value && (value[-1] & PROP_RESPONSE_SUCCESS);
 }
 
-static inline uint32_t mbox_get_clock(mbox_property_clock_t clock) {
-	mbox_property_struct(2) mbox;
-	mbox.data[0] = clock;
-	mbox.data[1] = 0;
-	mbox_property_call(MBOX_TAG_GET_CLOCK_STATE, mbox);
-	if (!mbox.data[1]) return 0;
 
-	mbox.data[0] = clock;
-	mbox.data[1] = 0;
-	mbox_property_call(MBOX_TAG_GET_CLOCK_RATE, mbox);
-	return mbox.data[1];
+/// Write the header and end tag of _batch_, which is then ready to be sent.
+static inline void mbox_batch_seal(mbox_batch_t *batch)
+{
+	batch->buf[0] = 4 * (batch->pos + 1);
+	batch->buf[1] = PROP_REQUEST;
+	batch->buf[batch->pos] = 0;
+}
+
+
+/// Send all tags of _batch_ in one transaction and block until the firmware
+/// has answered.  Return true on success.  The batch may be reused afterwards
+/// by calling mbox_batch_init() again.
+static inline int mbox_batch_call(mbox_batch_t *batch)
+{
+	mbox_batch_seal(batch);
+
+#if defined(linux) && !defined(__KERNEL__)
+	if (!raspi_vcio_call((void *)batch->buf)) return 0;
+#else
+	mbox_call_bus(MBOX_CH_PROPVC, batch->bus);
+#endif
+	memory_barrier();
+	return batch->buf[1] == PROP_RESPONSE_SUCCESS;
+}
+
+
+/// Query whether _clock_ is running.  Response in bit 0 of word 1.
+static inline volatile uint32_t *mbox_batch_get_clock_state(mbox_batch_t *batch, mbox_property_clock_t clock)
+{
+	volatile uint32_t *value = mbox_batch_add(batch, MBOX_TAG_GET_CLOCK_STATE, 2);
+	if (value) value[0] = clock;
+	return value;
+}
+
+
+/// Query the configured rate of _clock_.  Response in Hz in word 1.
+static inline volatile uint32_t *mbox_batch_get_clock_rate(mbox_batch_t *batch, mbox_property_clock_t clock)
+{
+	volatile uint32_t *value = mbox_batch_add(batch, MBOX_TAG_GET_CLOCK_RATE, 2);
+	if (value) value[0] = clock;
+	return value;
+}
+
+
+/// Query the measured rate of _clock_.  Response in Hz in word 1.
+static inline volatile uint32_t *mbox_batch_get_clock_measured(mbox_batch_t *batch, mbox_property_clock_t clock)
+{
+	volatile uint32_t *value = mbox_batch_add(batch, MBOX_TAG_GET_CLOCK_RATE_MEASURED, 2);
+	if (value) value[0] = clock;
+	return value;
+}
+
+
+/// Switch _clock_ on or off.  Response as for mbox_batch_get_clock_state().
+static inline volatile uint32_t *mbox_batch_set_clock_state(mbox_batch_t *batch, mbox_property_clock_t clock, int on)
+{
+	volatile uint32_t *value = mbox_batch_add(batch, MBOX_TAG_SET_CLOCK_STATE, 2);
+	if (value) {
+		value[0] = clock;
+		value[1] = !!on;
+	}
+	return value;
+}
+
+
+/// Set _clock_ to _freq_ Hz.  Response as for mbox_batch_get_clock_rate().
+static inline volatile uint32_t *mbox_batch_set_clock_rate(mbox_batch_t *batch, mbox_property_clock_t clock, uint32_t freq)
+{
+	volatile uint32_t *value = mbox_batch_add(batch, MBOX_TAG_SET_CLOCK_RATE, 3);
+	if (value) {
+		value[0] = clock;
+		value[1] = freq;
+	}
+	return value;
+}
+
+
+/// Query the SoC temperature.  Response in thousandths of °C in word 1.
+static inline volatile uint32_t *mbox_batch_get_temperature(mbox_batch_t *batch)
+{
+	return mbox_batch_add(batch, MBOX_TAG_GET_TEMPERATURE, 2);
+}
+
+
+/// Query the temperature at which the firmware starts throttling.  Response
+/// in thousandths of °C in word 1.
+static inline volatile uint32_t *mbox_batch_get_max_temperature(mbox_batch_t *batch)
+{
+	return mbox_batch_add(batch, MBOX_TAG_GET_MAX_TEMPERATURE, 2);
+}
+
+
+/// Query under-voltage and throttling flags.  Response in word 0: bits 0-3
+/// are the current state (under-voltage, frequency capped, throttled, soft
+/// temperature limit), bits 16-19 whether these occurred since boot.
+static inline volatile uint32_t *mbox_batch_get_throttled(mbox_batch_t *batch)
+{
+	return mbox_batch_add(batch, MBOX_TAG_GET_THROTTLED, 1);
+}
+
+/// @}
+
+
+static inline void mbox_set_clock(mbox_property_clock_t clock, uint32_t freq) {
+	MBOX_BATCH(batch, 16);
+	mbox_batch_set_clock_state(&batch, clock, 1);
+	mbox_batch_set_clock_rate(&batch, clock, freq);
+	mbox_batch_call(&batch);
+}
+
+static inline uint32_t mbox_get_clock(mbox_property_clock_t clock) {
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *state = mbox_batch_get_clock_state(&batch, clock);
+	volatile uint32_t *rate = mbox_batch_get_clock_rate(&batch, clock);
+	if (!mbox_batch_call(&batch) || !(state[1] & 1)) return 0;
+	return rate[1];
 }
 
 static inline uint32_t mbox_get_clock_measured(mbox_property_clock_t clock) {
-	mbox_property_struct(2) mbox;
-	mbox.data[0] = clock;
-	mbox.data[1] = 0;
-	mbox_property_call(MBOX_TAG_GET_CLOCK_RATE_MEASURED, mbox);
-	return mbox.data[1];
+	MBOX_BATCH(batch, 8);
+	volatile uint32_t *rate = mbox_batch_get_clock_measured(&batch, clock);
+	if (!mbox_batch_call(&batch)) return 0;
+	return rate[1];
+}
+
+
+/**
+ * @name Memory management
+ *
+ * GPU memory is allocated by the firmware and identified by a handle.  While
+ * locked, it stays at a fixed bus address, which may be handed to the DMA
+ * controller.  In user space, raspi_mem_alloc() also maps it into the
+ * process.
+ *
+ * @{
+ */
+
+/// Allocate _size_ bytes aligned to _align_ bytes with a combination of
+/// @ref mbox_mem_flag_t in _flags_.  Return the handle, or 0 on error.
+static inline uint32_t mbox_mem_alloc(uint32_t size, uint32_t align, uint32_t flags)
+{
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *value = mbox_batch_add(&batch, MBOX_TAG_ALLOCATE_MEMORY, 3);
+	if (!value) return 0;
+	value[0] = size;
+	value[1] = align;
+	value[2] = flags;
+	if (!mbox_batch_call(&batch) || !mbox_batch_ok(value)) return 0;
+	return value[0];
+}
+
+
+/// Lock the memory identified by _handle_ and return its bus address, or 0 on
+/// error.
+static inline uint32_t mbox_mem_lock(uint32_t handle)
+{
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *value = mbox_batch_add(&batch, MBOX_TAG_LOCK_MEMORY, 1);
+	if (!value) return 0;
+	value[0] = handle;
+	if (!mbox_batch_call(&batch) || !mbox_batch_ok(value)) return 0;
+	return value[0];
+}
+
+
+/// Unlock the memory identified by _handle_, which may then be moved by the
+/// firmware.  Return true on success.
+static inline int mbox_mem_unlock(uint32_t handle)
+{
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *value = mbox_batch_add(&batch, MBOX_TAG_UNLOCK_MEMORY, 1);
+	if (!value) return 0;
+	value[0] = handle;
+	return mbox_batch_call(&batch) && mbox_batch_ok(value) && value[0] == 0;
+}
+
+
+/// Release the memory identified by _handle_.  Return true on success.
+static inline int mbox_mem_release(uint32_t handle)
+{
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *value = mbox_batch_add(&batch, MBOX_TAG_RELEASE_MEMORY, 1);
+	if (!value) return 0;
+	value[0] = handle;
+	return mbox_batch_call(&batch) && mbox_batch_ok(value) && value[0] == 0;
+}
+
+/// @}
+
+
+/**
+ * @name Clock rate registry
+ *
+ * Peripheral dividers are derived from clock rates cached in
+ * @ref mbox_clock_table, so they need no mailbox round trip.  Only the UART
+ * drivers call the firmware themselves, since a wrong rate breaks framing:
+ * uart0_init_bitrate() sets and measures its reference clock, and
+ * uart1_init_bitrate() fetches the core clock if it is not cached.  Call
+ * mbox_clock_refresh() once during setup, before initializing the
+ * peripherals, and again whenever the firmware may have changed clock rates,
+ * e.g. after a governor switch.  Until then, the core clock is assumed to
+ * run at @ref CORE_CLOCK.
+ *
+ * The table is defined in hw.c, which must be linked in bare metal
+ * environments as well.
+ *
+ * @{
+ */
+
+/// Cached clock rates.
+typedef struct {
+	/// True once the rates have been read from the firmware
+	uint32_t valid;
+	/// Rate of each clock in Hz, 0 if unknown
+	uint32_t rate[MBOX_CLOCK_COUNT];
+} mbox_clock_table_t;
+
+/// The clock rates used by all divider calculations.  Defined in hw.c.
+extern mbox_clock_table_t mbox_clock_table;
+
+
+/// Re-read all clock rates from the firmware in one batch.  Return false if
+/// the firmware did not answer, in which case the table is left unchanged.
+static inline int mbox_clock_refresh(void)
+{
+	MBOX_BATCH(batch, 4 + 5*MBOX_CLOCK_COUNT);
+	volatile uint32_t *values[MBOX_CLOCK_COUNT];
+	int i;
+
+	for (i = 1; i < MBOX_CLOCK_COUNT; i++) {
+		values[i] = mbox_batch_get_clock_rate(&batch, (mbox_property_clock_t)i);
+	}
+	if (!mbox_batch_call(&batch)) return 0;
+
+	mbox_clock_table.rate[0] = 0;
+	for (i = 1; i < MBOX_CLOCK_COUNT; i++) {
+		mbox_clock_table.rate[i] = mbox_batch_ok(values[i]) ? values[i][1] : 0;
+	}
+	mbox_clock_table.valid = 1;
+	return 1;
+}
+
+
+/// Re-read the rate of _clock_ from the firmware and return it in Hz, or 0 if
+/// unknown.
+static inline uint32_t mbox_clock_update(mbox_property_clock_t clock)
+{
+	mbox_clock_table.rate[clock] = mbox_get_clock(clock);
+	return mbox_clock_table.rate[clock];
 }
 
+
+/// Return the cached rate of _clock_ in Hz, or 0 if unknown.  For the core
+/// clock, fall back to @ref CORE_CLOCK.  Never calls the firmware.
+static inline uint32_t mbox_clock_rate(mbox_property_clock_t clock)
+{
+	uint32_t rate;
+
+	rate = mbox_clock_table.rate[clock];
+	if (!rate && clock == MBOX_CLOCK_CORE) rate = CORE_CLOCK;
+	return rate;
+}
+
+
+/// Switch _clock_ on at _freq_ Hz in one transaction and return the rate set
+/// by the firmware, which is also cached, or 0 on error.
+static inline uint32_t mbox_clock_set(mbox_property_clock_t clock, uint32_t freq)
+{
+	MBOX_BATCH(batch, 16);
+	volatile uint32_t *rate;
+
+	mbox_batch_set_clock_state(&batch, clock, 1);
+	rate = mbox_batch_set_clock_rate(&batch, clock, freq);
+	if (!mbox_batch_call(&batch) || !mbox_batch_ok(rate)) return 0;
+
+	mbox_clock_table.rate[clock] = rate[1];
+	return rate[1];
+}
+
+/// @}
+
+
+#if !defined(linux) || defined(__KERNEL__)
+/**
+ * @name Asynchronous calls
+ *
+ * Requests are posted to the mailbox without waiting, and the replies are
+ * collected later by polling, e.g. once per iteration of a control loop.  Up
+ * to @ref MBOX_ASYNC_PENDING requests may be in flight at a time, on any
+ * channel, each identified by the id returned by mbox_async_submit().  A reply
+ * matches a request by its channel and bus address, so concurrent property
+ * batches need separate buffers.  Replies that match no request are kept per
+ * channel for mbox_async_read() instead of being dropped.
+ *
+ * Typical use is a batch with mbox_batch_get_temperature() and
+ * mbox_batch_get_throttled(), posted with mbox_batch_submit() and checked with
+ * mbox_batch_complete() on each following iteration, until its tags can be
+ * evaluated with mbox_batch_ok().
+ *
+ * Only available in bare metal environments and in the kernel.  In Linux user
+ * space, the kernel's mailbox driver owns the replies and `/dev/vcio` always
+ * blocks.
+ *
+ * @{
+ */
+
+/// Maximum number of requests in flight per @ref mbox_async_t.
+#define MBOX_ASYNC_PENDING 8
+
+/// Number of unmatched replies kept per channel.
+#define MBOX_ASYNC_DEPTH 4
+
+/// Number of mailbox channels.
+#define MBOX_ASYNC_CHANNELS 16
+
+
+/// State of the asynchronous mailbox calls.
+typedef struct {
+	/// Words posted for the requests in flight
+	uint32_t pending[MBOX_ASYNC_PENDING];
+	/// Bit _id_ set while request _id_ is in flight or unclaimed
+	uint32_t used;
+	/// Bit _id_ set once request _id_ has been answered
+	uint32_t done;
+	/// Replies matching no request, per channel
+	uint32_t reply[MBOX_ASYNC_CHANNELS][MBOX_ASYNC_DEPTH];
+	/// Index of the oldest unmatched reply per channel
+	uint8_t head[MBOX_ASYNC_CHANNELS];
+	/// Number of unmatched replies per channel
+	uint8_t count[MBOX_ASYNC_CHANNELS];
+	/// Number of unmatched replies dropped because their channel was full
+	uint32_t dropped;
+} mbox_async_t;
+
+
+/// Reset _async_ to no requests in flight and no unmatched replies.
+static inline void mbox_async_init(mbox_async_t *async)
+{
+	int i;
+
+	for (i = 0; i < MBOX_ASYNC_PENDING; i++) async->pending[i] = 0;
+	for (i = 0; i < MBOX_ASYNC_CHANNELS; i++) async->head[i] = async->count[i] = 0;
+	async->used = 0;
+	async->done = 0;
+	async->dropped = 0;
+}
+
+
+/// Post bus address _bus_ to channel _chan_ and return immediately.  Return the
+/// request id, or -1 if the mailbox is full or @ref MBOX_ASYNC_PENDING requests
+/// are in flight already.
+static inline int mbox_async_submit(mbox_async_t *async, raspi_MBOX_CHANNEL_t chan, uint32_t bus)
+{
+	uint32_t wanted = chan | bus;
+	int id;
+
+	for (id = 0; id < MBOX_ASYNC_PENDING; id++) if (!(async->used & 1u << id)) break;
+	if (id == MBOX_ASYNC_PENDING || HW.MBOX0.STATUS_FULL) return -1;
+
+	async->pending[id] = wanted;
+	async->used |= 1u << id;
+	async->done &= ~(1u << id);
+
+	memory_barrier();
+	HW.MBOX1.DATA = wanted;
+	memory_barrier();
+	return id;
+}
+
+
+/// Collect all replies waiting in the mailbox and return their number.  Never
+/// blocks.
+static inline uint32_t mbox_async_poll(mbox_async_t *async)
+{
+	uint32_t num = 0;
+
+	memory_barrier();
+	while (!HW.MBOX0.STATUS_EMPTY) {
+		uint32_t data = HW.MBOX0.DATA;
+		uint32_t chan = data & 0xf;
+		uint32_t waiting = async->used & ~async->done;
+		int id;
+
+		num++;
+		for (id = 0; id < MBOX_ASYNC_PENDING; id++) {
+			if ((waiting & 1u << id) && async->pending[id] == data) break;
+		}
+
+		if (id < MBOX_ASYNC_PENDING) {
+			async->done |= 1u << id;
+		} else if (async->count[chan] < MBOX_ASYNC_DEPTH) {
+			async->reply[chan][(async->head[chan] + async->count[chan]) % MBOX_ASYNC_DEPTH] = data;
+			async->count[chan]++;
+		} else {
+			async->dropped++;
+		}
+	}
+	memory_barrier();
+
+	return num;
+}
+
+
+/// Return true if request _id_ has been answered, polling the mailbox if not
+/// yet known.  The id is then free for the next request.  Never blocks.
+static inline int mbox_async_complete(mbox_async_t *async, int id)
+{
+	uint32_t bit = 1u << id;
+
+	if (!(async->done & bit)) mbox_async_poll(async);
+	if (!(async->done & bit)) return 0;
+
+	async->used &= ~bit;
+	async->done &= ~bit;
+	return 1;
+}
+
+
+/// Block until request _id_ has been answered and free its id.
+static inline void mbox_async_wait(mbox_async_t *async, int id)
+{
+	RASPI_TRACE_BEGIN(RASPI_TRACE_MBOX_CALL);
+	while (!mbox_async_complete(async, id)) RASPI_TRACE_SPIN();
+	RASPI_TRACE_END(RASPI_TRACE_MBOX_CALL);
+}
+
+
+/// Take the oldest reply received on _chan_ that matched no request, with the
+/// channel in its low 4 bits, and store it in _data_.  Return false if there
+/// is none.
+static inline int mbox_async_read(mbox_async_t *async, raspi_MBOX_CHANNEL_t chan, uint32_t *data)
+{
+	if (!async->count[chan]) mbox_async_poll(async);
+	if (!async->count[chan]) return 0;
+
+	*data = async->reply[chan][async->head[chan]];
+	async->head[chan] = (async->head[chan] + 1) % MBOX_ASYNC_DEPTH;
+	async->count[chan]--;
+	return 1;
+}
+
+
+/// Post all tags of _batch_ in one transaction and return immediately.
+/// Return the request id, or -1 as for mbox_async_submit().  The batch must
+/// not be touched until mbox_batch_complete() returns true.
+static inline int mbox_batch_submit(mbox_async_t *async, mbox_batch_t *batch)
+{
+	mbox_batch_seal(batch);
+	memory_barrier();
+	return mbox_async_submit(async, MBOX_CH_PROPVC, batch->bus);
+}
+
+
+/// Return true once the firmware has answered the batch posted as request
+/// _id_, and free _id_.  Its tags may then be evaluated with mbox_batch_ok().
+/// Never blocks.
+static inline int mbox_batch_complete(mbox_async_t *async, int id)
+{
+	if (!mbox_async_complete(async, id)) return 0;
+	memory_barrier();
+	return 1;
+}
+
+/// @}
+#endif
+
 #endif
 
 //@}
@@ -0,0 +1,270 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup pwm PWM Generator
+ *
+ * These functions drive the two channels of the PWM peripheral without using
+ * the regular Linux device driver.  Note that you *must* unload the PWM and
+ * audio kernel modules, or these functions will not work correctly.  The
+ * peripheral cannot be used as pacer for `wave.h` or `sampler.h` meanwhile.
+ *
+ * Each channel outputs within a period of _range_ clock ticks either _data_
+ * ticks high in one pulse (mark-space mode, e.g. for servos), the same duty
+ * cycle spread evenly over the period (balanced mode, e.g. for motors and
+ * LEDs), or the _range_ most significant bits of _data_ (serializer mode).
+ * _data_ is taken from the DAT registers or from the FIFO, which can be fed by
+ * DMA for arbitrary waveforms or audio samples.  When both channels use the
+ * FIFO, they take words from it alternately.
+ *
+ *   Channel | Pins
+ *  ---------|--------------------------------------------------
+ *   1       | GPIO12 Alt0, GPIO18 Alt5, GPIO40 Alt0
+ *   2       | GPIO13 Alt0, GPIO19 Alt5, GPIO41 Alt0, GPIO45 Alt0
+ *
+ * Declared in `pwm.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_PWM_H
+#define RASPI_DIRECTHW_PWM_H
+
+#include "hw.h"
+#include "dma.h"
+#include "clock.h"
+
+/// Size of the FIFO in words.
+#define raspi_PWM_FIFOSIZE 8
+
+/// Frequency in Hz of PLLD, the PWM clock source for fast clocks.
+#define PWM_PLLD_CLOCK CLOCK_PLLD_FREQ
+
+/// Frequency in Hz of the crystal oscillator, the PWM clock source for slow
+/// clocks.
+#define PWM_OSC_CLOCK CLOCK_OSC_FREQ
+
+
+/// Output modes of a PWM channel.
+typedef enum {
+	/// High for _data_ ticks, evenly distributed over the period
+	PWM_BALANCED,
+	/// High for _data_ ticks at the beginning of each period
+	PWM_MARK_SPACE,
+	/// Shift out the _range_ most significant bits of _data_
+	PWM_SERIALIZER
+} pwm_mode_t;
+
+
+/// Stop both channels and run the PWM clock at _freq_ Hz, derived from PLLD or
+/// the oscillator by an integer divider.  Return the frequency actually
+/// achieved, or 0 if _freq_ is out of range.
+static inline uint32_t pwm_init_clock(uint32_t freq)
+{
+	uint32_t achieved;
+
+	// the PWM peripheral needs a divider of at least 2
+	if (freq > PWM_PLLD_CLOCK / 2) return 0;
+	if (!clock_divider(PWM_PLLD_CLOCK, freq, 0) && !clock_divider(PWM_OSC_CLOCK, freq, 0)) return 0;
+
+	HW.PWM.CTL.U = 0;
+	HW.PWM.DMAC.U = 0;
+	memory_barrier();
+
+	achieved = clock_set(CM_PWM, freq, 0);
+	st_delay(10*ST_1us);
+	memory_barrier();
+
+	return achieved;
+}
+
+
+/// Connect _gpio_ to the PWM channel it is mapped to.  Return false if _gpio_
+/// has no PWM function.
+static inline int pwm_gpio(int gpio)
+{
+	raspi_GPIO_function function;
+
+	switch (gpio) {
+	case 12: case 13: case 40: case 41: case 45:
+		function = Alt0;
+		break;
+	case 18: case 19:
+		function = Alt5;
+		break;
+	default:
+		return 0;
+	}
+
+	memory_barrier();
+	gpio_configure(gpio, function, PullOff);
+	memory_barrier();
+	return 1;
+}
+
+
+/// Configure and enable _channel_ (1 or 2) in _mode_ with a period of _range_
+/// clock ticks.  If _fifo_ is true, data is taken from the FIFO, otherwise
+/// from pwm_set().  If _invert_ is true, the output polarity is inverted.
+static inline void pwm_configure(int channel, pwm_mode_t mode, uint32_t range, int fifo, int invert)
+{
+	int shift = channel == 2 ? 8 : 0;
+	union {
+		uint32_t U;
+		struct raspi_PWM_CTL_reg B;
+	} bits = { 0 };
+
+	bits.B.PWEN1 = 1;
+	bits.B.MODE1 = mode == PWM_SERIALIZER;
+	bits.B.MSEN1 = mode == PWM_MARK_SPACE;
+	bits.B.USEF1 = !!fifo;
+	bits.B.POLA1 = !!invert;
+
+	// more than one pending register write confuses the PWM peripheral
+	HW.PWM.CTL.U &= ~(0xffu << shift);
+	memory_barrier();
+	if (channel == 2) HW.PWM.RNG2 = range;
+	else HW.PWM.RNG1 = range;
+	st_delay(ST_1us);
+	HW.PWM.CTL.U |= bits.U << shift;
+	memory_barrier();
+}
+
+
+/// Set the data of _channel_ (1 or 2), i.e. the number of ticks high per
+/// period, or the bit pattern in serializer mode.
+static inline void pwm_set(int channel, uint32_t data)
+{
+	if (channel == 2) HW.PWM.DAT2 = data;
+	else HW.PWM.DAT1 = data;
+}
+
+
+/// Disable _channel_ (1 or 2).  Its output stays low, or high if inverted.
+static inline void pwm_disable(int channel)
+{
+	HW.PWM.CTL.U &= ~(1u << (channel == 2 ? 8 : 0));
+	memory_barrier();
+}
+
+
+/// Queue up to _len_ words from _data_ in the FIFO and return the number of
+/// words queued.  Never blocks.
+static inline uint32_t pwm_write_fifo(const uint32_t *data, uint32_t len)
+{
+	uint32_t num = 0;
+
+	while (num < len && !HW.PWM.STA.B.FULL1) HW.PWM.FIF1 = data[num++];
+	return num;
+}
+
+
+/**
+ * @name DMA feed
+ *
+ * Continuous feeding of the FIFO from a sample buffer, paced by the PWM DREQ
+ * signal.  Select FIFO mode for the respective channels with pwm_configure()
+ * before starting.
+ *
+ * @{
+ */
+
+/// Maximum number of words per control block on the DMA "lite" channels.
+#define raspi_PWM_DMA_CHUNK 16384
+
+/// Size in bytes of the DMA memory required by pwm_dma_setup() for _num_
+/// words.
+#define pwm_dma_memsize(num) \
+	(((num) + raspi_PWM_DMA_CHUNK - 1) / raspi_PWM_DMA_CHUNK * sizeof(raspi_dma_control_block))
+
+
+/// Prepare control blocks in _cb_ for feeding _num_ words starting at bus
+/// address _samples_ into the FIFO.  If _loop_ is true, the samples repeat
+/// until stopped.  Return false if _num_ is 0 or _cb_ is smaller than
+/// `pwm_dma_memsize(num)`.
+static inline int pwm_dma_setup(raspi_mem_t *cb, uint32_t samples, uint32_t num, int loop)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)cb->virt;
+	uint32_t chunks = (num + raspi_PWM_DMA_CHUNK - 1) / raspi_PWM_DMA_CHUNK;
+	uint32_t i;
+
+	const struct raspi_DMA_TI_reg ti = {
+		.PERMAP = DMA_PERMAP_PWM,
+		.DEST_DREQ = 1,
+		.SRC_INC = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || cb->size < pwm_dma_memsize(num)) return 0;
+
+	for (i = 0; i < chunks; i++) {
+		uint32_t offset = i * raspi_PWM_DMA_CHUNK;
+		uint32_t size = num - offset;
+		uint32_t next = i + 1 < chunks ? MEM_BUS(cb, &blocks[i + 1]) : loop ? cb->bus : 0;
+		if (size > raspi_PWM_DMA_CHUNK) size = raspi_PWM_DMA_CHUNK;
+
+		dma_cb_set(&blocks[i], ti, samples + 4*offset, HW_BUS(HW.PWM.FIF1), 4*size, next);
+	}
+
+	return 1;
+}
+
+
+/// Start feeding the samples prepared by pwm_dma_setup() in _cb_ on DMA
+/// channel _dma_.  Return immediately.
+static inline void pwm_dma_start(const raspi_mem_t *cb, int dma)
+{
+	const struct raspi_PWM_DMAC_reg dmac = {
+		.ENAB = 1,
+		.PANIC = 3,
+		.DREQ = 7,
+	};
+
+	dma_reset(dma);
+	HW.PWM.DMAC.B = dmac;
+	memory_barrier();
+	dma_start(dma, cb->bus);
+}
+
+
+/// Return true while samples are being fed on DMA channel _dma_.  Looping
+/// feeds never finish.
+static inline int pwm_dma_busy(int dma)
+{
+	return dma_busy(dma);
+}
+
+
+/// Stop feeding samples on DMA channel _dma_ immediately.  Channels in FIFO
+/// mode stop once the FIFO has run empty.
+static inline void pwm_dma_stop(int dma)
+{
+	dma_reset(dma);
+	HW.PWM.DMAC.U = 0;
+	memory_barrier();
+}
+
+/// @}
+
+#endif
+
+///@}
@@ -0,0 +1,112 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup rng Hardware Random Number Generator
+ *
+ * These functions read the hardware random number generator directly, without
+ * a system call per word.  The generator fills a FIFO, whose fill level is
+ * checked once per burst, so bulk reads run at the rate of the generator.
+ *
+ * The Linux `bcm2835-rng` driver uses the same generator for `/dev/hwrng`.
+ * Both can coexist, but words read here are not seen by the kernel and vice
+ * versa.  Only Pi 1-3 are supported, later models have a different generator.
+ *
+ * Declared in `rng.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_RNG_H
+#define RASPI_DIRECTHW_RNG_H
+
+#include "hw.h"
+
+/// Number of initial words to discard after enabling the generator, as their
+/// randomness is lower.  Same as in the Linux driver.
+#define RNG_WARMUP_COUNT 0x40000
+
+
+/// Enable the generator if it is not running yet, discarding the first
+/// @ref RNG_WARMUP_COUNT words.  If _fast_ is true, select the double speed
+/// mode, which reduces the randomness per word.
+static inline void rng_init(int fast)
+{
+	struct raspi_RNG_CTRL_reg ctrl = {
+		.RBGEN = 1,
+	};
+
+	ctrl.RBG2X = !!fast;
+
+	if (!HW.RNG.CTRL.B.RBGEN) {
+		HW.RNG.INT_MASK.B.INT_OFF = 1;
+		HW.RNG.STATUS.U = RNG_WARMUP_COUNT;
+	}
+	HW.RNG.CTRL.B = ctrl;
+	memory_barrier();
+}
+
+
+/// Return the number of words available in the FIFO.  Always 0 during
+/// warm-up.
+static inline uint32_t rng_available(void)
+{
+	return HW.RNG.STATUS.B.VAL;
+}
+
+
+/// Copy up to _max_ random words into _buf_ and return the number of words
+/// copied.  Never blocks.
+static inline uint32_t rng_read_available(uint32_t *buf, uint32_t max)
+{
+	uint32_t num = 0;
+
+	while (num < max) {
+		uint32_t level = HW.RNG.STATUS.B.VAL;
+		if (!level) break;
+		if (level > max - num) level = max - num;
+		while (level--) buf[num++] = HW.RNG.DATA;
+	}
+
+	return num;
+}
+
+
+/// Fill _buf_ with _len_ random words.  Block until done.
+static inline void rng_read_buf(uint32_t *buf, uint32_t len)
+{
+	uint32_t num = 0;
+
+	while (num < len) num += rng_read_available(buf + num, len - num);
+}
+
+
+/// Return a single random word.  Block if the FIFO is currently empty.
+static inline uint32_t rng_read(void)
+{
+	while (!HW.RNG.STATUS.B.VAL);
+	return HW.RNG.DATA;
+}
+
+#endif
+
+///@}
@@ -0,0 +1,183 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup sampler GPIO Logic Sampler
+ *
+ * These functions capture the levels of GPIO0-31 at a fixed sample rate
+ * without CPU involvement.  A DMA channel copies `HW.GPIO.LEV[0]` into a ring
+ * buffer, paced by the PWM or PCM peripheral just like the waveform generator
+ * (see wave_pacer_init()).  The application consumes samples in batches.
+ *
+ * Each sample takes two DMA control blocks, which limits the practical sample
+ * rate to about 1 MHz.  Samples must be consumed at least once per ring buffer
+ * revolution, older ones are overwritten without notice.
+ *
+ * Declared in `sampler.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_SAMPLER_H
+#define RASPI_DIRECTHW_SAMPLER_H
+
+#include "hw.h"
+#include "dma.h"
+#include "wave.h"
+
+
+/// State of a running capture.
+typedef struct {
+	/// DMA memory holding control blocks and the sample ring
+	raspi_mem_t *mem;
+	/// Ring buffer size in samples
+	uint32_t num;
+	/// Index of the next sample to consume
+	uint32_t tail;
+	/// Index of the next sample to be written, while stopped
+	uint32_t head;
+	/// DMA channel, -1 while stopped
+	int dma;
+} sampler_t;
+
+
+/// Size in bytes of the DMA memory required by sampler_setup() for a ring
+/// buffer of _num_ samples.
+#define sampler_memsize(num) ((num) * (2 * sizeof(raspi_dma_control_block) + 4) + 4)
+
+
+/// Prepare _sampler_ for capturing into a ring buffer of _num_ samples in
+/// _mem_, paced by _pacer_.  Return false if _mem_ is smaller than
+/// `sampler_memsize(num)`.
+static inline int sampler_setup(sampler_t *sampler, raspi_mem_t *mem, wave_pacer_t pacer, uint32_t num)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)mem->virt;
+	volatile uint32_t *samples = (volatile uint32_t *)(blocks + 2*num);
+	volatile uint32_t *dummy = samples + num;
+	uint32_t fifo;
+	uint32_t i;
+
+	const struct raspi_DMA_TI_reg ti_sample = {
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_delay = {
+		.PERMAP = pacer == WAVE_PWM ? DMA_PERMAP_PWM : DMA_PERMAP_PCM_TX,
+		.DEST_DREQ = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || mem->size < sampler_memsize(num)) return 0;
+
+	fifo = pacer == WAVE_PWM ? HW_BUS(HW.PWM.FIF1) : HW_BUS(HW.PCM.FIFO);
+	*dummy = 0;
+
+	for (i = 0; i < num; i++) {
+		samples[i] = 0;
+		dma_cb_set(&blocks[2*i], ti_sample,
+				HW_BUS(HW.GPIO.LEV[0]), MEM_BUS(mem, &samples[i]), 4,
+				MEM_BUS(mem, &blocks[2*i + 1]));
+		dma_cb_set(&blocks[2*i + 1], ti_delay,
+				MEM_BUS(mem, dummy), fifo, 4,
+				i + 1 < num ? MEM_BUS(mem, &blocks[2*i + 2]) : mem->bus);
+	}
+
+	sampler->mem = mem;
+	sampler->num = num;
+	sampler->tail = 0;
+	sampler->head = 0;
+	sampler->dma = -1;
+	return 1;
+}
+
+
+/// Start capturing on DMA channel _dma_.  The pacer must have been initialized
+/// with wave_pacer_init() for the desired sample period.
+static inline void sampler_start(sampler_t *sampler, int dma)
+{
+	sampler->dma = dma;
+	sampler->tail = 0;
+	sampler->head = 0;
+	dma_reset(dma);
+	dma_start(dma, sampler->mem->bus);
+}
+
+
+/// Return the index of the next sample to be written by the DMA controller.
+static inline uint32_t sampler_head(const sampler_t *sampler)
+{
+	uint32_t cb;
+	uint32_t index;
+
+	if (sampler->dma < 0) return sampler->head;
+
+	cb = dma_channel(sampler->dma)->CONBLK_AD - sampler->mem->bus;
+	index = cb / sizeof(raspi_dma_control_block);
+
+	// while processing the delay block of sample n, n is complete
+	index = (index + 1) / 2;
+	if (index >= sampler->num) index = 0;
+	return index;
+}
+
+
+/// Stop capturing.  Samples not consumed yet remain available.
+static inline void sampler_stop(sampler_t *sampler)
+{
+	if (sampler->dma < 0) return;
+	dma_channel(sampler->dma)->CS.B.ACTIVE = 0;
+	while (dma_channel(sampler->dma)->CS.B.ACTIVE);
+	sampler->head = sampler_head(sampler);
+	dma_reset(sampler->dma);
+	sampler->dma = -1;
+}
+
+
+/// Return the number of samples available for sampler_read().
+static inline uint32_t sampler_available(const sampler_t *sampler)
+{
+	return (sampler_head(sampler) + sampler->num - sampler->tail) % sampler->num;
+}
+
+
+/// Copy up to _max_ samples into _buf_ and return the number of samples
+/// copied.  Bit _n_ of each sample is the level of GPIO _n_.  Never blocks.
+static inline uint32_t sampler_read(sampler_t *sampler, uint32_t *buf, uint32_t max)
+{
+	const volatile uint32_t *samples = (const volatile uint32_t *)
+		((volatile raspi_dma_control_block *)sampler->mem->virt + 2*sampler->num);
+	uint32_t num = sampler_available(sampler);
+	uint32_t i;
+
+	if (num > max) num = max;
+	memory_barrier();
+	for (i = 0; i < num; i++) {
+		buf[i] = samples[sampler->tail];
+		if (++sampler->tail == sampler->num) sampler->tail = 0;
+	}
+
+	return num;
+}
+
+#endif
+
+///@}
@@ -37,16 +37,18 @@
 #define RASPI_DIRECTHW_SPI_H
 
 #include "hw.h"
+#include "dma.h"
+#include "mailbox.h"
 
 /// Size of both, the read and the write FIFO.
 #define raspi_SPI_FIFOSIZE 16
 
 
-/// Configure SPI hardware for _speed_ bit/s.
+/// Configure SPI hardware for _speed_ bit/s, based on the cached core clock.
 static inline void spi_init(uint32_t speed)
 {
 	int i;
-	uint32_t div = CORE_CLOCK / speed;
+	uint32_t div = mbox_clock_rate(MBOX_CLOCK_CORE) / speed;
 
 	if (div >= 65536) div = 0;
 	if (div < 2) div = 2;
@@ -55,7 +57,7 @@ static inline void spi_init(uint32_t speed)
 	HW.SPI0.CS.B.CPHA = 1;
 
 	memory_barrier();
-	for (i = 7; i <= 11; i++) gpio_configure(i, Alt0);
+	for (i = 7; i <= 11; i++) gpio_configure(i, Alt0, PullOff);
 	memory_barrier();
 }
 
@@ -73,8 +75,10 @@ static inline void spi_start(int destination)
 /// Stop SPI transfer. Block until all pending data is transmitted.
 static inline void spi_stop(void)
 {
-	while (!HW.SPI0.CS.B.DONE);
+	RASPI_TRACE_BEGIN(RASPI_TRACE_SPI_STOP);
+	while (!HW.SPI0.CS.B.DONE) RASPI_TRACE_SPIN();
 	HW.SPI0.CS.B.TA = 0;
+	RASPI_TRACE_END(RASPI_TRACE_SPI_STOP);
 }
 
 
@@ -95,7 +99,9 @@ static inline int spi_poll(int num)
 /// so each `spi_read()` must be paired with an `spi_write()`.
 static inline uint8_t spi_read(void)
 {
-	while (!HW.SPI0.CS.B.RXD);
+	RASPI_TRACE_BEGIN(RASPI_TRACE_SPI_READ);
+	while (!HW.SPI0.CS.B.RXD) RASPI_TRACE_SPIN();
+	RASPI_TRACE_END(RASPI_TRACE_SPI_READ);
 	return HW.SPI0.FIFO;
 }
 
@@ -115,6 +121,331 @@ static inline void spi_flush(void)
 	while (HW.SPI0.CS.B.TA && !HW.SPI0.CS.B.DONE);
 }
 
+
+/// Send _len_ bytes from _tx_ and store the bytes received meanwhile in _rx_.
+/// Either one may be NULL to send zeros or discard received data.  Block until
+/// all bytes have been received.  `spi_start()` must be called before, and
+/// the receive FIFO must be empty, i.e. each previous `spi_write()` must have
+/// been paired with an `spi_read()`.
+static inline void spi_transfer(const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+	uint32_t sent = 0;
+	uint32_t received = 0;
+
+	while (received < len) {
+		struct raspi_SPI0_CS_reg cs;
+		uint32_t num;
+
+		// Never have more bytes in flight than the receive FIFO can hold.
+		// Then the transmit FIFO cannot overflow either, so no need to
+		// check TXD for each byte.
+		num = raspi_SPI_FIFOSIZE - (sent - received);
+		if (num > len - sent) num = len - sent;
+		for (; num; num--, sent++) HW.SPI0.FIFO = tx ? tx[sent] : 0;
+
+		// Read as many bytes as the receive FIFO is known to hold
+		cs = HW.SPI0.CS.B;
+		if (cs.RXF) num = raspi_SPI_FIFOSIZE;
+		else if (cs.RXR) num = raspi_SPI_FIFOSIZE*3/4;
+		else num = cs.RXD;
+		if (num > sent - received) num = sent - received;
+
+		for (; num; num--, received++) {
+			uint8_t data = HW.SPI0.FIFO;
+			if (rx) rx[received] = data;
+		}
+	}
+}
+
+
+/// Send _len_ bytes from _tx_, discarding received data.  See spi_transfer().
+static inline void spi_write_buf(const uint8_t *tx, uint32_t len)
+{
+	spi_transfer(tx, 0, len);
+}
+
+
+/// Receive _len_ bytes into _rx_ while sending zeros.  See spi_transfer().
+static inline void spi_read_buf(uint8_t *rx, uint32_t len)
+{
+	spi_transfer(0, rx, len);
+}
+
+
+/**
+ * @name DMA transfers
+ *
+ * Full-duplex transfers of arbitrary length, paced by the SPI DREQ signals,
+ * which run at the configured clock rate without CPU involvement.  One DMA
+ * channel feeds the transmit FIFO, a second one empties the receive FIFO.
+ *
+ * One prepared transfer covers at most @ref raspi_SPI_DMA_CHUNK bytes, the
+ * limit of the DLEN register.  The TX channel is paced by the TX DREQ only, so
+ * a second header queued behind the data would be shifted out as data while
+ * the first chunk is still active.  spi_transfer_dma() therefore runs longer
+ * transfers chunk by chunk.  Chip select is deasserted briefly between chunks.
+ *
+ * @{
+ */
+
+/// Maximum number of bytes per prepared transfer, limited by the DLEN
+/// register.
+#define raspi_SPI_DMA_CHUNK 65532
+
+/// Size in bytes of the DMA memory required by spi_dma_setup().
+#define spi_dma_memsize() (3 * sizeof(raspi_dma_control_block) + 8)
+
+
+/// Prepare control blocks in _cb_ for a transfer of _len_ bytes (a multiple of
+/// 4, at most @ref raspi_SPI_DMA_CHUNK) to _destination_ (0 or 1, see
+/// `spi_start()`).  _tx_ and _rx_ are bus addresses of the transmit and
+/// receive buffers.  If _tx_ is 0, zeros are sent.  If _rx_ is 0, received
+/// data is discarded.  Return false if _len_ is invalid or _cb_ is smaller
+/// than `spi_dma_memsize()`.
+static inline int spi_dma_setup(raspi_mem_t *cb, int destination, uint32_t tx, uint32_t rx, uint32_t len)
+{
+	// RX data, TX header, TX data.  This puts the control block of the RX
+	// chain at index 0 and the first one of the TX chain at index 1.
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)cb->virt;
+	volatile uint32_t *header = (volatile uint32_t *)(blocks + 3);
+	volatile uint32_t *zero = header + 1;
+
+	const struct raspi_DMA_TI_reg ti_tx = {
+		.PERMAP = DMA_PERMAP_SPI_TX,
+		.DEST_DREQ = 1,
+		.SRC_INC = !!tx,
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_header = {
+		.PERMAP = DMA_PERMAP_SPI_TX,
+		.DEST_DREQ = 1,
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_rx = {
+		.PERMAP = DMA_PERMAP_SPI_RX,
+		.SRC_DREQ = 1,
+		.DEST_INC = !!rx,
+		.DEST_IGNORE = !rx,
+		.WAIT_RESP = 1,
+	};
+
+	if (len == 0 || len % 4 || len > raspi_SPI_DMA_CHUNK || cb->size < spi_dma_memsize()) return 0;
+
+	// The first FIFO write while TA is clear goes to DLEN (upper half) and
+	// CS bits 0-7.  Keep CPHA, CPOL and CSPOL, set CS and TA.
+	*header = len << 16 | (HW.SPI0.CS.U & 0x4c) | (destination & 3) | 0x80;
+	*zero = 0;
+
+	dma_cb_set(&blocks[0], ti_rx,
+			HW_BUS(HW.SPI0.FIFO), rx, len, 0);
+	dma_cb_set(&blocks[1], ti_header,
+			MEM_BUS(cb, header), HW_BUS(HW.SPI0.FIFO), 4,
+			MEM_BUS(cb, &blocks[2]));
+	dma_cb_set(&blocks[2], ti_tx,
+			tx ? tx : MEM_BUS(cb, zero), HW_BUS(HW.SPI0.FIFO), len, 0);
+
+	return 1;
+}
+
+
+/// Start the transfer prepared by spi_dma_setup() in _cb_, using DMA channels
+/// _tx_dma_ and _rx_dma_.  Return immediately.
+static inline void spi_dma_start(const raspi_mem_t *cb, int tx_dma, int rx_dma)
+{
+	HW.SPI0.CS.B.TA = 0;
+	HW.SPI0.CS.B.CLEAR = 3;
+	HW.SPI0.CS.B.ADCS = 1;
+	HW.SPI0.CS.B.DMAEN = 1;
+
+	dma_reset(tx_dma);
+	dma_reset(rx_dma);
+	dma_start(rx_dma, cb->bus);
+	dma_start(tx_dma, cb->bus + sizeof(raspi_dma_control_block));
+}
+
+
+/// Return true while a transfer started by spi_dma_start() is in progress.
+static inline int spi_dma_busy(int rx_dma)
+{
+	return dma_busy(rx_dma);
+}
+
+
+/// Block until the transfer started by spi_dma_start() is complete and return
+/// to regular (non-DMA) operation.
+static inline void spi_dma_finish(int tx_dma, int rx_dma)
+{
+	dma_wait(tx_dma);
+	dma_wait(rx_dma);
+	HW.SPI0.CS.B.DMAEN = 0;
+	HW.SPI0.CS.B.ADCS = 0;
+	memory_barrier();
+}
+
+
+/// Transfer _len_ bytes (a multiple of 4) via DMA and block until done,
+/// chunk by chunk if _len_ exceeds @ref raspi_SPI_DMA_CHUNK.  See
+/// spi_dma_setup() for the parameters.  Return false on invalid parameters.
+static inline int spi_transfer_dma(raspi_mem_t *cb, int tx_dma, int rx_dma, int destination, uint32_t tx, uint32_t rx, uint32_t len)
+{
+	uint32_t offset;
+
+	if (len == 0 || len % 4) return 0;
+
+	for (offset = 0; offset < len; offset += raspi_SPI_DMA_CHUNK) {
+		uint32_t size = len - offset;
+		if (size > raspi_SPI_DMA_CHUNK) size = raspi_SPI_DMA_CHUNK;
+
+		if (!spi_dma_setup(cb, destination, tx ? tx + offset : 0, rx ? rx + offset : 0, size)) return 0;
+		spi_dma_start(cb, tx_dma, rx_dma);
+		spi_dma_finish(tx_dma, rx_dma);
+	}
+	return 1;
+}
+
+/// @}
+
+
+/**
+ * @name Job queue
+ *
+ * Lock-free sharing of SPI0 between threads or cores.  Any number of
+ * producers submit transactions with spi_queue_submit() without taking a
+ * lock.  A single servicing context owns the peripheral and runs them back to
+ * back with spi_queue_service(), e.g. in a dedicated real-time thread, so the
+ * bus never waits for a mutex between transactions.
+ *
+ * The queue is a bounded ring, in which each slot carries a sequence number
+ * marking it free or filled.  Producers claim slots with a compare-and-swap on
+ * the head index, so a submission never blocks and fails only if the queue is
+ * full.
+ *
+ * @{
+ */
+
+#ifndef SPI_QUEUE_SIZE
+/// Number of slots of an @ref spi_queue_t.  Must be a power of two.
+#define SPI_QUEUE_SIZE 16
+#endif
+
+
+/// An SPI transaction.  Owned by the submitter, which must keep it valid until
+/// done is set.
+typedef struct {
+	/// Chip select line, see spi_start()
+	int destination;
+	/// Bytes to send, or NULL to send zeros
+	const uint8_t *tx;
+	/// Buffer for received bytes, or NULL to discard them
+	uint8_t *rx;
+	/// Number of bytes
+	uint32_t len;
+	/// Set by the servicing context once the transaction is complete
+	volatile uint32_t done;
+} spi_job_t;
+
+
+/// Queue of pending transactions.
+typedef struct {
+	struct {
+		/// Position at which the slot is free (pos) or filled (pos + 1)
+		volatile uint32_t seq;
+		spi_job_t *job;
+	} slot[SPI_QUEUE_SIZE];
+	/// Next position to fill, shared by all producers
+	volatile uint32_t head;
+	/// Next position to service, owned by the servicing context
+	uint32_t tail;
+} spi_queue_t;
+
+
+/// Initialize _queue_ as empty.
+static inline void spi_queue_init(spi_queue_t *queue)
+{
+	uint32_t i;
+
+	for (i = 0; i < SPI_QUEUE_SIZE; i++) {
+		queue->slot[i].seq = i;
+		queue->slot[i].job = 0;
+	}
+	queue->head = 0;
+	queue->tail = 0;
+}
+
+
+/// Append _job_ to _queue_.  Safe to call from any number of threads at once.
+/// Return false if the queue is full.  Never blocks.
+static inline int spi_queue_submit(spi_queue_t *queue, spi_job_t *job)
+{
+	uint32_t pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+	job->done = 0;
+	for (;;) {
+		uint32_t seq = __atomic_load_n(&queue->slot[pos % SPI_QUEUE_SIZE].seq, __ATOMIC_ACQUIRE);
+		int32_t diff = (int32_t)(seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		} else if (diff < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	queue->slot[pos % SPI_QUEUE_SIZE].job = job;
+	__atomic_store_n(&queue->slot[pos % SPI_QUEUE_SIZE].seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/// Run all transactions in _queue_, including those submitted meanwhile, and
+/// return their number.  Only one context may call this.  It must own SPI0,
+/// which must have been configured with spi_init().
+static inline uint32_t spi_queue_service(spi_queue_t *queue)
+{
+	uint32_t num = 0;
+
+	for (;;) {
+		uint32_t pos = queue->tail;
+		spi_job_t *job;
+
+		if (__atomic_load_n(&queue->slot[pos % SPI_QUEUE_SIZE].seq, __ATOMIC_ACQUIRE) != pos + 1) break;
+		job = queue->slot[pos % SPI_QUEUE_SIZE].job;
+		__atomic_store_n(&queue->slot[pos % SPI_QUEUE_SIZE].seq, pos + SPI_QUEUE_SIZE, __ATOMIC_RELEASE);
+		queue->tail = pos + 1;
+
+		memory_barrier();
+		spi_start(job->destination);
+		spi_transfer(job->tx, job->rx, job->len);
+		spi_stop();
+		memory_barrier();
+
+		__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+		num++;
+	}
+
+	return num;
+}
+
+
+/// Return true if _job_ is complete and its receive buffer is valid.
+static inline int spi_job_done(const spi_job_t *job)
+{
+	return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+
+/// Block until _job_ is complete.
+static inline void spi_job_wait(const spi_job_t *job)
+{
+	while (!spi_job_done(job));
+}
+
+/// @}
+
 #endif
 
 ///@}
@@ -0,0 +1,208 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup spi_aux Auxiliary SPI Masters (SPI1/SPI2)
+ *
+ * These functions drive the two auxiliary SPI masters, which are independent
+ * of SPI0 and thus allow talking to further devices in parallel.  Note that
+ * you *must* unload the `spi-bcm2835aux` kernel module, or these functions
+ * will not work correctly.  _bus_ is 1 for SPI1 (GPIO16-21 on the 40-pin
+ * header) or 2 for SPI2 (GPIO40-45, compute modules only).
+ *
+ * Each FIFO entry carries a frame of 1-32 bits, as configured with
+ * spi_aux_init(), so 24 or 32 bit ADC frames take a single FIFO write.  Frames
+ * are passed right-aligned in `uint32_t` words and shifted MSB first.  Both
+ * FIFOs hold @ref raspi_SPI_AUX_FIFOSIZE entries.
+ *
+ *   Bus | SCLK   | MOSI   | MISO   | CE0-2
+ *  -----|--------|--------|--------|----------
+ *   1   | GPIO21 | GPIO20 | GPIO19 | GPIO18-16
+ *   2   | GPIO42 | GPIO41 | GPIO40 | GPIO43-45
+ *
+ * Declared in `spi_aux.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_SPI_AUX_H
+#define RASPI_DIRECTHW_SPI_AUX_H
+
+#include "hw.h"
+#include "mailbox.h"
+
+/// Size of both, the receive and the transmit FIFO, in entries.
+#define raspi_SPI_AUX_FIFOSIZE 4
+
+
+/// Return the registers of auxiliary SPI master _bus_ (1 or 2).
+static inline volatile raspi_SPI1_regs *spi_aux_regs(int bus)
+{
+	if (bus == 2) return &HW.SPI2;
+	return &HW.SPI1;
+}
+
+
+/// Enable auxiliary SPI master _bus_ for frames of _bits_ bits (1-32) at
+/// _speed_ bit/s in SPI mode 0-3 as given by _cpol_ and _cpha_, based on the
+/// cached core clock.  Return the bit rate actually achieved, which never
+/// exceeds _speed_, or 0 if _bits_ is invalid or _speed_ is below the slowest
+/// rate the divider can reach.
+static inline uint32_t spi_aux_init(int bus, uint32_t speed, int bits, int cpol, int cpha)
+{
+	volatile raspi_SPI1_regs *spi = spi_aux_regs(bus);
+	uint32_t core = mbox_clock_rate(MBOX_CLOCK_CORE);
+	struct raspi_SPI1_CNTL0_reg cntl0 = {
+		.MSB_OUT = 1,
+		.ENABLE = 1,
+		.CS = 7,
+	};
+	const struct raspi_SPI1_CNTL1_reg cntl1 = {
+		.MSB_IN = 1,
+	};
+	uint32_t div;
+	int gpio;
+
+	if (bits < 1 || bits > 32 || !speed) return 0;
+
+	div = (core + 2*speed - 1) / (2*speed);
+	if (div < 1) div = 1;
+	if (div > 4096) return 0;
+
+	cntl0.SHIFT_LENGTH = bits;
+	cntl0.SPEED = div - 1;
+	cntl0.INVERT_CLK = !!cpol;
+	cntl0.OUT_RISING = !!cpol ^ !!cpha;
+	cntl0.IN_RISING = !cntl0.OUT_RISING;
+
+	if (bus == 2) {
+		for (gpio = 40; gpio <= 45; gpio++) gpio_configure(gpio, Alt4, PullOff);
+	} else {
+		for (gpio = 16; gpio <= 21; gpio++) gpio_configure(gpio, Alt4, PullOff);
+	}
+	memory_barrier();
+
+	if (bus == 2) HW.AUX.ENB.B.SPI2 = 1;
+	else HW.AUX.ENB.B.SPI1 = 1;
+	memory_barrier();
+
+	spi->CNTL0.U = 0;
+	spi->CNTL0.B.CLEAR_FIFOS = 1;
+	spi->CNTL1.B = cntl1;
+	spi->CNTL0.B = cntl0;
+	memory_barrier();
+
+	return core / (2*div);
+}
+
+
+/// Select chip select line _destination_ (0-2) of _bus_ for the following
+/// transfers.  Must not be called while a transfer is in progress.
+static inline void spi_aux_start(int bus, int destination)
+{
+	spi_aux_regs(bus)->CNTL0.B.CS = 7 & ~(1u << destination);
+}
+
+
+/// Return the configured frame width of _bus_ in bits.
+static inline int spi_aux_bits(int bus)
+{
+	int bits = spi_aux_regs(bus)->CNTL0.B.SHIFT_LENGTH;
+	return bits ? bits : 32;
+}
+
+
+/// Send _len_ frames from _tx_ on _bus_ and store the frames received
+/// meanwhile in _rx_.  Either one may be NULL to send zeros or discard received
+/// data.  Chip select stays asserted for all _len_ frames.  Block until all
+/// frames have been received.
+static inline void spi_aux_transfer(int bus, const uint32_t *tx, uint32_t *rx, uint32_t len)
+{
+	volatile raspi_SPI1_regs *spi = spi_aux_regs(bus);
+	int bits = spi_aux_bits(bus);
+	uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+
+	memory_barrier();
+	while (received < len) {
+		uint32_t num;
+
+		// Never have more frames in flight than the receive FIFO can hold
+		num = raspi_SPI_AUX_FIFOSIZE - (sent - received);
+		if (num > len - sent) num = len - sent;
+		for (; num; num--, sent++) {
+			// frames go out starting at bit 31
+			uint32_t data = tx ? tx[sent] << (32 - bits) : 0;
+			if (sent + 1 < len) spi->TXHOLD[0] = data;
+			else spi->IO[0] = data;
+		}
+
+		num = spi->STAT.B.RX_LEVEL;
+		if (num > sent - received) num = sent - received;
+		for (; num; num--, received++) {
+			uint32_t data = spi->IO[0] & mask;
+			if (rx) rx[received] = data;
+		}
+	}
+	memory_barrier();
+}
+
+
+/// Send _len_ frames from _tx_ on _bus_, discarding received data.  See
+/// spi_aux_transfer().
+static inline void spi_aux_write_buf(int bus, const uint32_t *tx, uint32_t len)
+{
+	spi_aux_transfer(bus, tx, 0, len);
+}
+
+
+/// Receive _len_ frames into _rx_ on _bus_ while sending zeros.  See
+/// spi_aux_transfer().
+static inline void spi_aux_read_buf(int bus, uint32_t *rx, uint32_t len)
+{
+	spi_aux_transfer(bus, 0, rx, len);
+}
+
+
+/// Send and receive a single frame on _bus_.  Block until done.
+static inline uint32_t spi_aux_transfer_word(int bus, uint32_t tx)
+{
+	uint32_t rx;
+	spi_aux_transfer(bus, &tx, &rx, 1);
+	return rx;
+}
+
+
+/// Disable auxiliary SPI master _bus_.
+static inline void spi_aux_disable(int bus)
+{
+	spi_aux_regs(bus)->CNTL0.U = 0;
+	memory_barrier();
+	if (bus == 2) HW.AUX.ENB.B.SPI2 = 0;
+	else HW.AUX.ENB.B.SPI1 = 0;
+	memory_barrier();
+}
+
+#endif
+
+///@}
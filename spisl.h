@@ -32,7 +32,10 @@
  * It (ab)uses the PCM interface for this, but there is no way to synchronize to
  * byte boundaries.  You must synchronize to the master clock in some way.
  * spisl_synchronize() does so by expecting a continuous byte stream and
- * glitching the clock until the bytes read correctly.
+ * glitching the clock until the bytes read correctly.  Once synchronized,
+ * alignment is kept as long as the PCM interface keeps running, which the DMA
+ * transfers below help with.  On boards with the 40-pin header, the native
+ * slave in `bscsl.h` is the better choice.
  *
  * Declared in `spisl.h`.
  *
@@ -68,10 +71,14 @@
 #define RASPI_DIRECTHW_SPISL_H
 
 #include "hw.h"
+#include "dma.h"
 
 
-/// Configure PCM hardware to act as SPI slave.
-static inline void spisl_init()
+/// Configure PCM hardware to act as SPI slave with frames of _width_ bits,
+/// which must be 8 to 32.  Each FIFO access moves one frame, so wider frames
+/// need fewer accesses for the same amount of data.  Return false if _width_
+/// is out of range.
+static inline int spisl_init_width(int width)
 {
 	int i;
 
@@ -88,8 +95,8 @@ static inline void spisl_init()
 	};
 
 	const struct raspi_PCM_MODE_reg mode_master = {
-		.FLEN = 7,
-		.FSLEN = 7,
+		.FLEN = width - 1,
+		.FSLEN = width - 1,
 		.CLKM = 0,
 		.CLKI = 0,
 		.FSM = 0,
@@ -98,8 +105,8 @@ static inline void spisl_init()
 	};
 
 	const struct raspi_PCM_MODE_reg mode_slave = {
-		.FLEN = 7,
-		.FSLEN = 7,
+		.FLEN = width - 1,
+		.FSLEN = width - 1,
 		.CLKM = 1,
 		.CLKI = 0,
 		.FSM = 1,
@@ -119,8 +126,14 @@ static inline void spisl_init()
 		.DIVI = 250,
 	};
 
+	if (width < 8 || width > 32) return 0;
+
+	// fill or drain the FIFO in bursts once it is 3/4 empty or full
+	init_cs.TXTHR = 1;
+	init_cs.RXTHR = 2;
+
 	// disable interface for reconfiguration
-	for (i = 28; i <= 31; i++) gpio_configure(i, Input);
+	for (i = 28; i <= 31; i++) gpio_configure(i, Input, PullOff);
 	memory_barrier();
 
 	// empty FIFO
@@ -137,14 +150,14 @@ static inline void spisl_init()
 	HW.PCM.INTSTC.U = 15;
 	HW.PCM.GRAY.U = 0;
 
-	HW.PCM.RXC.B.CH1WEX = 0;
+	HW.PCM.RXC.B.CH1WEX = (width - 8) >> 4;
 	HW.PCM.RXC.B.CH1POS = 0;
-	HW.PCM.RXC.B.CH1WID = 0;
+	HW.PCM.RXC.B.CH1WID = (width - 8) & 15;
 	HW.PCM.RXC.B.CH1EN = 1;
 
-	HW.PCM.TXC.B.CH1WEX = 0;
+	HW.PCM.TXC.B.CH1WEX = (width - 8) >> 4;
 	HW.PCM.TXC.B.CH1POS = 0;
-	HW.PCM.TXC.B.CH1WID = 0;
+	HW.PCM.TXC.B.CH1WID = (width - 8) & 15;
 	HW.PCM.TXC.B.CH1EN = 1;
 
 	// execute reset sequence
@@ -163,15 +176,30 @@ static inline void spisl_init()
 	HW.PCM.MODE.B = mode_slave;
 
 	memory_barrier();
-	gpio_configure(28, Alt2);
-	gpio_configure(29, Alt2);
-	gpio_configure(30, Alt2);
-	gpio_configure(31, Alt2);
+	gpio_configure(28, Alt2, PullOff);
+	gpio_configure(29, Alt2, PullOff);
+	gpio_configure(30, Alt2, PullOff);
+	gpio_configure(31, Alt2, PullOff);
 	memory_barrier();
 
 	HW.PCM.MODE.B.CLK_DIS = 0;
 
 	memory_barrier();
+	return 1;
+}
+
+
+/// Configure PCM hardware to act as SPI slave with 8 bit frames.
+static inline void spisl_init()
+{
+	spisl_init_width(8);
+}
+
+
+/// Return the frame width in bits configured by spisl_init_width().
+static inline int spisl_width(void)
+{
+	return 8 + HW.PCM.RXC.B.CH1WID + 16 * HW.PCM.RXC.B.CH1WEX;
 }
 
 
@@ -206,6 +234,27 @@ static inline void spisl_write(uint8_t data)
 }
 
 
+/// Read a single frame received via SPI.  Block if FIFO is currently empty.
+/// The first bit received is the most significant one.
+static inline uint32_t spisl_read_word(void)
+{
+	while (!HW.PCM.CS.B.RXD);
+	return HW.PCM.FIFO;
+}
+
+
+/// Send frame _data_ via SPI.  Block if FIFO is currently full.  Received
+/// frames are discarded, as with spisl_write().
+static inline void spisl_write_word(uint32_t data)
+{
+	uint32_t dummy;
+	while (!HW.PCM.CS.B.TXD);
+	HW.PCM.FIFO = data;
+	while (HW.PCM.CS.B.RXD) dummy = HW.PCM.FIFO;
+	(void)dummy;
+}
+
+
 /// Block until transmit FIFO is empty.
 static inline void spisl_flush()
 {
@@ -213,6 +262,59 @@ static inline void spisl_flush()
 }
 
 
+/// Depth of the PCM FIFOs in frames.
+#define raspi_PCM_FIFOSIZE 64
+
+
+/// Copy up to _max_ received frames into _buf_ and return the number of
+/// frames copied.  Never blocks.
+static inline uint32_t spisl_read_buf(uint32_t *buf, uint32_t max)
+{
+	uint32_t num = 0;
+
+	while (num < max) {
+		struct raspi_PCM_CS_reg cs = HW.PCM.CS.B;
+		uint32_t burst;
+
+		// Read as many frames as the FIFO is known to hold
+		if (cs.RXF) burst = raspi_PCM_FIFOSIZE;
+		else if (cs.RXR && cs.RXTHR == 2) burst = raspi_PCM_FIFOSIZE*3/4;
+		else burst = cs.RXD;
+		if (!burst) break;
+		if (burst > max - num) burst = max - num;
+
+		for (; burst; burst--) buf[num++] = HW.PCM.FIFO;
+	}
+
+	return num;
+}
+
+
+/// Queue up to _len_ frames from _buf_ for transmission and return the
+/// number of frames queued.  Never blocks.  Unlike spisl_write(), received
+/// frames are left for spisl_read_buf().
+static inline uint32_t spisl_write_buf(const uint32_t *buf, uint32_t len)
+{
+	uint32_t num = 0;
+
+	while (num < len) {
+		struct raspi_PCM_CS_reg cs = HW.PCM.CS.B;
+		uint32_t burst;
+
+		// Write as many frames as the FIFO is known to accept
+		if (cs.TXE) burst = raspi_PCM_FIFOSIZE;
+		else if (cs.TXW && cs.TXTHR == 1) burst = raspi_PCM_FIFOSIZE*3/4;
+		else burst = cs.TXD;
+		if (!burst) break;
+		if (burst > len - num) burst = len - num;
+
+		for (; burst; burst--) HW.PCM.FIFO = buf[num++];
+	}
+
+	return num;
+}
+
+
 
 /**
  *  Synchronize to SPI master.  Due to the way the Raspberry Pi PCM interface
@@ -221,7 +323,8 @@ static inline void spisl_flush()
  *  until it reads the marker byte back.  This function will adjust reception
  *  parameters until the marker bytes come through correctly, then send a marker
  *  byte as acknowledgement.  Finally, the master sends (marker ^ 0xff) to
- *  finish synchronization.
+ *  finish synchronization.  With frames wider than 8 bits, the marker is 0x81
+ *  followed by zero bits, and all bits of the final frame are inverted.
  *
  *  You can use this function as template in case you require some other way of
  *  synchronization, e.g. when you don't have the option to modify the master's
@@ -231,28 +334,365 @@ static inline void spisl_flush()
  */
 static inline void spisl_synchronize(void)
 {
-	uint8_t marker = 0x81;
-	uint8_t incoming;
+	int width = spisl_width();
+	uint32_t marker = 0x81u << (width - 8);
+	uint32_t incoming;
 	int cnt = 0;
+	RASPI_TRACE_BEGIN(RASPI_TRACE_SPISL_SYNCHRONIZE);
 
-	incoming = spisl_read();
+	incoming = spisl_read_word();
 	while (cnt++ < 10) {
 		if (incoming != marker) {
 			HW.PCM.MODE.B.CLK_DIS = 1;
+			RASPI_TRACE_SPIN();
 			st_delay(ST_1us);
 			cnt = 0;
 			HW.PCM.MODE.B.CLK_DIS = 0;
 		}
-		incoming = spisl_read();
+		incoming = spisl_read_word();
 	}
 
-	spisl_write(marker);
+	spisl_write_word(marker);
+
+	marker ^= 0xffffffffu >> (32 - width);
+
+	while (incoming != marker) {
+		RASPI_TRACE_SPIN();
+		incoming = spisl_read_word();
+	}
+	RASPI_TRACE_END(RASPI_TRACE_SPISL_SYNCHRONIZE);
+}
+
+
+/**
+ * @name DMA transfers
+ *
+ * Fixed-size transfers, paced by the PCM DREQ signals.  One DMA channel feeds
+ * the transmit FIFO, a second one empties the receive FIFO, so neither can
+ * overflow or run dry during a transfer even if the CPU is busy elsewhere.
+ * Call spisl_synchronize() once before the first transfer; alignment is kept
+ * for all subsequent ones as long as the master clocks whole frames.
+ *
+ * Each FIFO word holds one frame of the width configured by
+ * spisl_init_width(), so the transmit and receive buffers contain one 32-bit
+ * word per frame.  With 32 bit frames, no memory is wasted.  Transfers are
+ * limited to 16384 frames on the DMA "lite" channels.
+ *
+ * @{
+ */
+
+/// Size in bytes of the DMA memory required by spisl_dma_setup().
+#define spisl_dma_memsize() (2 * sizeof(raspi_dma_control_block) + 4)
+
+
+/// Prepare control blocks in _cb_ for a transfer of _len_ frames.  _tx_ and
+/// _rx_ are bus addresses of the respective word buffers.  If _tx_ is 0, zeros
+/// are sent.  If _rx_ is 0, received data is discarded.  Return false if _len_
+/// is 0 or exceeds 16384, or if _cb_ is smaller than `spisl_dma_memsize()`.
+static inline int spisl_dma_setup(raspi_mem_t *cb, uint32_t tx, uint32_t rx, uint32_t len)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)cb->virt;
+	volatile uint32_t *zero = (volatile uint32_t *)(blocks + 2);
+
+	const struct raspi_DMA_TI_reg ti_rx = {
+		.PERMAP = DMA_PERMAP_PCM_RX,
+		.SRC_DREQ = 1,
+		.DEST_INC = !!rx,
+		.DEST_IGNORE = !rx,
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_tx = {
+		.PERMAP = DMA_PERMAP_PCM_TX,
+		.DEST_DREQ = 1,
+		.SRC_INC = !!tx,
+		.WAIT_RESP = 1,
+	};
 
-	marker ^= 0xff;
+	// 4 * len must fit the TXFR_LEN of the DMA "lite" channels
+	if (len == 0 || len > 16384 || cb->size < spisl_dma_memsize()) return 0;
 
-	while (incoming != marker) incoming = spisl_read();
+	*zero = 0;
+	dma_cb_set(&blocks[0], ti_rx, HW_BUS(HW.PCM.FIFO), rx, 4 * len, 0);
+	dma_cb_set(&blocks[1], ti_tx, tx ? tx : MEM_BUS(cb, zero), HW_BUS(HW.PCM.FIFO), 4 * len, 0);
+	return 1;
 }
 
+
+/// Enable the PCM DREQ signals for both FIFOs.
+static inline void spisl_dma_enable(void)
+{
+	// request RX service as soon as a frame arrives, keep TX well ahead
+	const struct raspi_PCM_DREQ_reg dreq = {
+		.RX = 1,
+		.TX = 48,
+		.RX_PANIC = 16,
+		.TX_PANIC = 16,
+	};
+
+	HW.PCM.DREQ.B = dreq;
+	HW.PCM.CS.B.DMAEN = 1;
+	memory_barrier();
+}
+
+
+/// Start the transfer prepared by spisl_dma_setup() in _cb_, using DMA channels
+/// _tx_dma_ and _rx_dma_.  Return immediately.  The transmit FIFO should be
+/// empty, see spisl_flush(), and the receive FIFO should not hold stale data.
+static inline void spisl_dma_start(const raspi_mem_t *cb, int tx_dma, int rx_dma)
+{
+	spisl_dma_enable();
+	dma_reset(tx_dma);
+	dma_reset(rx_dma);
+	dma_start(rx_dma, cb->bus);
+	dma_start(tx_dma, cb->bus + sizeof(raspi_dma_control_block));
+}
+
+
+/// Return true while a transfer started by spisl_dma_start() is in progress.
+static inline int spisl_dma_busy(int rx_dma)
+{
+	return dma_busy(rx_dma);
+}
+
+
+/// Block until the transfer started by spisl_dma_start() is complete and
+/// return to regular (non-DMA) operation.  This only returns once the master
+/// has clocked all frames.
+static inline void spisl_dma_finish(int tx_dma, int rx_dma)
+{
+	dma_wait(tx_dma);
+	dma_wait(rx_dma);
+	HW.PCM.CS.B.DMAEN = 0;
+	memory_barrier();
+}
+
+/// @}
+
+
+/**
+ * @name DMA ring buffers
+ *
+ * Continuous reception into a ring buffer and continuous transmission from
+ * another one, paced by the PCM DREQ signals.  Received frames are consumed in
+ * batches with spisl_ring_read(), so there is no hard real-time requirement
+ * for polling the FIFO anymore.  The reply stream is queued with
+ * spisl_ring_write(); while it runs dry, the ring contents are sent again.
+ *
+ * The ring is passed @ref SPISL_RING_LAPS times by as many chained control
+ * blocks, so the active one tells the exact number of frames transferred.
+ * Frames lost due to the ring overflowing (reception) or running dry
+ * (transmission) are counted, provided the ring is serviced at least once per
+ * @ref SPISL_RING_LAPS revolutions.  Frames per ring are limited to 16384 on
+ * the DMA "lite" channels.
+ *
+ * @{
+ */
+
+#ifndef SPISL_RING_LAPS
+/// Number of control blocks looping over each ring buffer.
+#define SPISL_RING_LAPS 64
+#endif
+
+
+/// State of a receive or transmit ring.
+typedef struct {
+	/// DMA memory holding the control blocks and the ring buffer
+	raspi_mem_t *mem;
+	/// Ring buffer size in frames
+	uint32_t num;
+	/// Frames consumed (reception) or queued (transmission) so far, modulo
+	/// `SPISL_RING_LAPS * num`
+	uint32_t pos;
+	/// Frames lost due to ring overflow (reception) or underflow (transmission)
+	uint32_t lost;
+	/// Number of PCM receive FIFO overflows seen, i.e. the DMA controller
+	/// could not keep up
+	uint32_t fifo_errors;
+	/// DMA channel
+	int dma;
+	/// True for a transmit ring
+	int tx;
+} spisl_ring_t;
+
+
+/// Size in bytes of the DMA memory required by spisl_ring_start() for a ring
+/// buffer of _num_ frames.
+#define spisl_ring_memsize(num) (SPISL_RING_LAPS * sizeof(raspi_dma_control_block) + 4 * (num))
+
+
+/// Start continuous reception (_tx_ false) or transmission (_tx_ true) with a
+/// ring buffer of _num_ frames in _mem_ on DMA channel _dma_.  Return false if
+/// _mem_ is smaller than `spisl_ring_memsize(num)`.
+static inline int spisl_ring_start(spisl_ring_t *ring, raspi_mem_t *mem, uint32_t num, int dma, int tx)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)mem->virt;
+	volatile uint32_t *frames = (volatile uint32_t *)(blocks + SPISL_RING_LAPS);
+	uint32_t buffer = MEM_BUS(mem, frames);
+	uint32_t i;
+
+	const struct raspi_DMA_TI_reg ti_rx = {
+		.PERMAP = DMA_PERMAP_PCM_RX,
+		.SRC_DREQ = 1,
+		.DEST_INC = 1,
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_tx = {
+		.PERMAP = DMA_PERMAP_PCM_TX,
+		.DEST_DREQ = 1,
+		.SRC_INC = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || num > 16384 || mem->size < spisl_ring_memsize(num)) return 0;
+
+	for (i = 0; i < num; i++) frames[i] = 0;
+	for (i = 0; i < SPISL_RING_LAPS; i++) {
+		uint32_t next = MEM_BUS(mem, &blocks[(i + 1) % SPISL_RING_LAPS]);
+		if (tx) dma_cb_set(&blocks[i], ti_tx, buffer, HW_BUS(HW.PCM.FIFO), 4*num, next);
+		else dma_cb_set(&blocks[i], ti_rx, HW_BUS(HW.PCM.FIFO), buffer, 4*num, next);
+	}
+
+	ring->mem = mem;
+	ring->num = num;
+	ring->pos = 0;
+	ring->lost = 0;
+	ring->fifo_errors = 0;
+	ring->dma = dma;
+	ring->tx = !!tx;
+
+	spisl_dma_enable();
+	dma_reset(dma);
+	dma_start(dma, mem->bus);
+	return 1;
+}
+
+
+/// Stop the ring.  When both rings are stopped, call spisl_dma_finish() or
+/// clear `HW.PCM.CS.B.DMAEN` to return to regular operation.
+static inline void spisl_ring_stop(spisl_ring_t *ring)
+{
+	dma_reset(ring->dma);
+}
+
+
+/// Return the number of frames transferred by the DMA controller, modulo
+/// `SPISL_RING_LAPS * num`.
+static inline uint32_t spisl_ring_dma_pos(const spisl_ring_t *ring)
+{
+	volatile raspi_DMA15_regs *dma = dma_channel(ring->dma);
+	uint32_t buffer = ring->mem->bus + SPISL_RING_LAPS * sizeof(raspi_dma_control_block);
+	uint32_t cb;
+	uint32_t addr;
+	uint32_t lap;
+	uint32_t index;
+
+	// the control block may change while reading the address
+	do {
+		cb = dma->CONBLK_AD;
+		addr = ring->tx ? dma->CB.SOURCE_AD : dma->CB.DEST_AD;
+	} while (cb != dma->CONBLK_AD);
+
+	lap = (cb - ring->mem->bus) / sizeof(raspi_dma_control_block);
+	index = (addr - buffer) / 4;
+	if (lap >= SPISL_RING_LAPS) lap = 0;
+	if (index > ring->num) index = 0;
+	return (lap * ring->num + index) % (SPISL_RING_LAPS * ring->num);
+}
+
+
+/// Return the number of frames available for spisl_ring_read().  If the ring
+/// has overflowed, the frames are dropped and counted as lost.
+static inline uint32_t spisl_ring_available(spisl_ring_t *ring)
+{
+	uint32_t total = SPISL_RING_LAPS * ring->num;
+	uint32_t head = spisl_ring_dma_pos(ring);
+	uint32_t num = (head + total - ring->pos) % total;
+
+	// RXERR is cleared by writing 1
+	if (HW.PCM.CS.B.RXERR) {
+		HW.PCM.CS.B.RXERR = 1;
+		ring->fifo_errors++;
+	}
+
+	// The frame at head is being overwritten, so num frames are intact only if
+	// num < ring->num.
+	if (num >= ring->num) {
+		ring->lost += num;
+		ring->pos = head;
+		return 0;
+	}
+
+	return num;
+}
+
+
+/// Copy up to _max_ received frames into _buf_ and return the number of
+/// frames copied.  Never blocks.
+static inline uint32_t spisl_ring_read(spisl_ring_t *ring, uint32_t *buf, uint32_t max)
+{
+	const volatile uint32_t *frames = (const volatile uint32_t *)
+		((volatile raspi_dma_control_block *)ring->mem->virt + SPISL_RING_LAPS);
+	uint32_t total = SPISL_RING_LAPS * ring->num;
+	uint32_t num = spisl_ring_available(ring);
+	uint32_t i;
+
+	if (num > max) num = max;
+	memory_barrier();
+	for (i = 0; i < num; i++) {
+		buf[i] = frames[ring->pos % ring->num];
+		ring->pos = (ring->pos + 1) % total;
+	}
+
+	return num;
+}
+
+
+/// Return the number of frames which may be queued with spisl_ring_write().
+/// If the ring has run dry, the stale frames sent meanwhile are counted as
+/// lost.
+static inline uint32_t spisl_ring_space(spisl_ring_t *ring)
+{
+	uint32_t total = SPISL_RING_LAPS * ring->num;
+	uint32_t tail = spisl_ring_dma_pos(ring);
+	uint32_t queued = (ring->pos + total - tail) % total;
+
+	// the DMA controller has overtaken the producer
+	if (queued > ring->num) {
+		ring->lost += total - queued;
+		ring->pos = tail;
+		queued = 0;
+	}
+
+	// one slot stays free to tell a full ring from an empty one
+	if (queued >= ring->num - 1) return 0;
+	return ring->num - 1 - queued;
+}
+
+
+/// Queue up to _len_ frames from _buf_ for transmission and return the number
+/// of frames queued.  Never blocks.
+static inline uint32_t spisl_ring_write(spisl_ring_t *ring, const uint32_t *buf, uint32_t len)
+{
+	volatile uint32_t *frames = (volatile uint32_t *)
+		((volatile raspi_dma_control_block *)ring->mem->virt + SPISL_RING_LAPS);
+	uint32_t total = SPISL_RING_LAPS * ring->num;
+	uint32_t num = spisl_ring_space(ring);
+	uint32_t i;
+
+	if (num > len) num = len;
+	for (i = 0; i < num; i++) {
+		frames[ring->pos % ring->num] = buf[i];
+		ring->pos = (ring->pos + 1) % total;
+	}
+	memory_barrier();
+
+	return num;
+}
+
+/// @}
+
 #endif
 
 ///@}
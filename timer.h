@@ -0,0 +1,194 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup timer Deadlines and Periodic Tasks
+ *
+ * These functions build on the 64 bit system timer to wait for absolute
+ * deadlines and to run control loops at a fixed period without drift.
+ *
+ * The system timer has four compare channels, of which the GPU firmware uses
+ * 0 and 2.  Channels 1 and 3 are free for the ARM: st_compare_arm() sets the
+ * match flag in `HW.ST.CS` once the lower 32 bits of the timer reach the
+ * deadline, which also raises an interrupt if it is enabled in the interrupt
+ * controller.
+ *
+ * Waiting does not spin the CPU for the whole time where avoidable.  In Linux
+ * user space, the calling thread sleeps until shortly before the deadline and
+ * spins for the remaining @ref ST_SLEEP_MARGIN only.  Elsewhere, define
+ * ST_IDLE() before including this file, e.g. as `asm volatile ("wfi")` when the
+ * compare interrupt of the channel passed to the scheduler is enabled.
+ *
+ * Declared in `timer.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_TIMER_H
+#define RASPI_DIRECTHW_TIMER_H
+
+#include "hw.h"
+
+#if defined(linux) && !defined(__KERNEL__)
+#include <time.h>
+#endif
+
+#ifndef ST_SLEEP_MARGIN
+/// Time before a deadline at which sleeping ends and spinning begins in Linux
+/// user space, covering the scheduling latency of the kernel.
+#define ST_SLEEP_MARGIN (200*ST_1us)
+#endif
+
+#ifndef ST_IDLE
+/// Executed in every iteration while waiting for a deadline.  Does nothing by
+/// default.
+#define ST_IDLE() /**/
+#endif
+
+/// Mask of the compare channels available to the ARM.
+#define ST_COMPARE_ARM_MASK ((1u << 1) | (1u << 3))
+
+
+/// Return true if _deadline_ has passed.
+static inline int st_passed(st_time64_t deadline)
+{
+	return st_now64() >= deadline;
+}
+
+
+/// Arm compare channel _channel_ (1 or 3) for _deadline_, which must be less
+/// than 2^32 ticks (about 71 minutes) ahead, and clear its match flag.  Return
+/// false if _channel_ is reserved by the GPU, or if _deadline_ has passed
+/// already, in which case the match flag will not be set in time.
+static inline int st_compare_arm(int channel, st_time64_t deadline)
+{
+	if (channel < 0 || channel > 3 || !(ST_COMPARE_ARM_MASK & (1u << channel))) return 0;
+
+	HW.ST.C[channel] = (uint32_t)deadline;
+	HW.ST.CS.U = 1u << channel;
+	memory_barrier();
+	return !st_passed(deadline);
+}
+
+
+/// Return true if the match flag of compare channel _channel_ is set.
+static inline int st_compare_pending(int channel)
+{
+	return !!(HW.ST.CS.U & (1u << channel));
+}
+
+
+/// Clear the match flag of compare channel _channel_, e.g. from its interrupt
+/// handler.
+static inline void st_compare_clear(int channel)
+{
+	HW.ST.CS.U = 1u << channel;
+	memory_barrier();
+}
+
+
+/// Block until _deadline_, without spinning where possible.
+static inline void st_wait_until(st_time64_t deadline)
+{
+#if defined(linux) && !defined(__KERNEL__)
+	st_time64_t now = st_now64();
+
+	if (now + ST_SLEEP_MARGIN < deadline) {
+		st_time64_t sleep = deadline - ST_SLEEP_MARGIN - now;
+		struct timespec ts;
+		ts.tv_sec = sleep / ST_1s;
+		ts.tv_nsec = (sleep % ST_1s) * (1000000000 / ST_1s);
+		nanosleep(&ts, NULL);
+	}
+#endif
+
+	while (!st_passed(deadline)) ST_IDLE();
+}
+
+
+/// Block for _delay_, without spinning where possible.
+static inline void st_sleep(st_delta_t delay)
+{
+	st_wait_until(st_now64() + delay);
+}
+
+
+/**
+ * @name Periodic scheduler
+ *
+ * Wake-ups at multiples of a fixed period from the start time.  Since each
+ * deadline is derived from the previous one rather than from the time of
+ * waking up, latencies do not accumulate.
+ *
+ * @{
+ */
+
+/// State of a periodic task.
+typedef struct {
+	/// Next deadline
+	st_time64_t next;
+	/// Period in ticks
+	st_delta_t period;
+	/// Number of periods missed altogether
+	uint32_t overruns;
+	/// Compare channel armed for each deadline, or -1 for none
+	int channel;
+} st_periodic_t;
+
+
+/// Start _task_ with a period of _period_ ticks, its first deadline one period
+/// from now.  If _channel_ is 1 or 3, that compare channel is armed for every
+/// deadline, e.g. to wake up the CPU via ST_IDLE().
+static inline void st_periodic_init(st_periodic_t *task, st_delta_t period, int channel)
+{
+	task->period = period ? period : 1;
+	task->next = st_now64() + task->period;
+	task->overruns = 0;
+	task->channel = channel;
+}
+
+
+/// Block until the next deadline of _task_ and advance it by one period.
+/// Return the number of periods missed since the last call, whose deadlines
+/// are skipped, or 0 if the task kept up.
+static inline uint32_t st_periodic_wait(st_periodic_t *task)
+{
+	st_time64_t now = st_now64();
+	uint32_t missed = 0;
+
+	if (now >= task->next + task->period) {
+		missed = (now - task->next) / task->period;
+		task->next += (st_time64_t)missed * task->period;
+		task->overruns += missed;
+	}
+
+	if (task->channel >= 0) st_compare_arm(task->channel, task->next);
+	st_wait_until(task->next);
+	task->next += task->period;
+	return missed;
+}
+
+/// @}
+
+#endif
+
+///@}
@@ -36,14 +36,43 @@
 #define RASPI_DIRECTHW_UART0_H
 
 #include "hw.h"
+#include "dma.h"
 #include "mailbox.h"
 
-/// Configure UART hardware for given bit rate.  115200 bit/s is the fastest
-/// speed available.
-static inline void uart0_init(unsigned int bitrate)
+/// Minimum UART reference clock in Hz selected by uart0_init_bitrate().
+#define UART0_MIN_CLOCK 48000000
+
+
+/// Configure UART hardware for _bitrate_, up to 4 Mbit/s or more.  The UART
+/// reference clock is set to a multiple of 16 * _bitrate_ of at least
+/// @ref UART0_MIN_CLOCK, so the divider is exact if the firmware can generate
+/// that clock.  Return the bit rate actually achieved, or 0 if it is out of
+/// range.  If _error_ppm_ is not NULL, store the deviation from _bitrate_ in
+/// parts per million there.
+static inline uint32_t uart0_init_bitrate(uint32_t bitrate, int32_t *error_ppm)
 {
-	const uint32_t UARTCLK = 3000000;
-	mbox_set_clock(MBOX_CLOCK_UART, UARTCLK);
+	MBOX_BATCH(batch, 24);
+	volatile uint32_t *rate;
+	volatile uint32_t *measured;
+	uint32_t UARTCLK;
+	uint32_t div64;
+	uint32_t actual;
+
+	if (!bitrate) return 0;
+
+	// Set the clock, and read back what it really runs at, in one transaction
+	UARTCLK = (UART0_MIN_CLOCK + 16*bitrate - 1) / (16*bitrate) * 16*bitrate;
+	mbox_batch_set_clock_state(&batch, MBOX_CLOCK_UART, 1);
+	rate = mbox_batch_set_clock_rate(&batch, MBOX_CLOCK_UART, UARTCLK);
+	measured = mbox_batch_get_clock_measured(&batch, MBOX_CLOCK_UART);
+	if (mbox_batch_call(&batch)) {
+		if (mbox_batch_ok(rate)) mbox_clock_table.rate[MBOX_CLOCK_UART] = rate[1];
+		if (mbox_batch_ok(measured) && measured[1]) UARTCLK = measured[1];
+	}
+
+	// divider in units of 1/64, rounded: UARTCLK / (16 * bitrate) * 64
+	div64 = ((uint64_t)UARTCLK*4 + bitrate/2) / bitrate;
+	if (div64 < 64 || div64 >= 65536*64) return 0;
 
 	HW.UART0.CR.B.UARTEN = 0;
 	while (HW.UART0.FR.B.BUSY);
@@ -56,14 +85,25 @@ static inline void uart0_init(unsigned int bitrate)
 	HW.UART0.LCRH.B.FEN = 1;
 	HW.UART0.LCRH.B.WLEN = 3;
 
-	HW.UART0.IBRD.B.IBRD = UARTCLK/bitrate/16;
-	HW.UART0.FBRD.B.FBRD = UARTCLK*4/bitrate;
+	HW.UART0.IBRD.B.IBRD = div64 >> 6;
+	HW.UART0.FBRD.B.FBRD = div64 & 63;
 	memory_barrier();
 
 	HW.UART0.CR.B.UARTEN = 1;
 	gpio_configure(14, Alt0, PullOff);
 	gpio_configure(15, Alt0, PullOff);
 	memory_barrier();
+
+	actual = (uint64_t)UARTCLK*4 / div64;
+	if (error_ppm) *error_ppm = ((int64_t)actual - bitrate) * 1000000 / bitrate;
+	return actual;
+}
+
+
+/// Configure UART hardware for given bit rate.  See uart0_init_bitrate().
+static inline void uart0_init(unsigned int bitrate)
+{
+	uart0_init_bitrate(bitrate, 0);
 }
 
 
@@ -88,17 +128,403 @@ static inline uint8_t uart0_read(void)
 /// Send _data_ via UART.  Block if FIFO is currently full.
 static inline void uart0_write(uint8_t data)
 {
-	while (HW.UART0.FR.B.TXFF);
+	RASPI_TRACE_BEGIN(RASPI_TRACE_UART0_WRITE);
+	while (HW.UART0.FR.B.TXFF) RASPI_TRACE_SPIN();
 	HW.UART0.DR.B.DATA = data;
+	RASPI_TRACE_END(RASPI_TRACE_UART0_WRITE);
 }
 
 
 /// Block until transmit FIFO is empty.
 static inline void uart0_flush()
 {
-	while (!HW.UART0.FR.B.TXFE || HW.UART0.FR.B.BUSY);
+	RASPI_TRACE_BEGIN(RASPI_TRACE_UART0_FLUSH);
+	while (!HW.UART0.FR.B.TXFE || HW.UART0.FR.B.BUSY) RASPI_TRACE_SPIN();
+	RASPI_TRACE_END(RASPI_TRACE_UART0_FLUSH);
+}
+
+
+/**
+ * @name Buffered I/O
+ *
+ * Software ring buffers in front of the hardware FIFOs allow transferring
+ * whole telegrams without waiting for each byte.  uart0_service() moves data
+ * between ring buffers and FIFOs.  Call it from the UART0 interrupt handler
+ * (kernel or Xenomai, see @ref UART0_IRQ), or let the buffered I/O functions
+ * call it (polled mode, e.g. in user space).
+ *
+ * In interrupt mode, uart0_write_buf() masks the UART0 interrupt while
+ * filling the transmit FIFO, so the interrupt handler must run on the same
+ * CPU as the application.
+ *
+ * @{
+ */
+
+#ifndef UART0_BUFSIZE
+/// Size in bytes of each ring buffer.  Must be a power of 2.
+#define UART0_BUFSIZE 1024
+#endif
+
+/// Interrupt number of UART0, i.e. bit 25 in `HW.IRQ.enable[1]`.
+#define UART0_IRQ 57
+
+
+/// Ring buffer state for uart0_service() and the buffered I/O functions.
+typedef struct {
+	uint8_t rx[UART0_BUFSIZE];
+	uint8_t tx[UART0_BUFSIZE];
+	/// Bytes ever received, written by uart0_service() only
+	volatile uint32_t rx_head;
+	/// Bytes ever read by the application
+	volatile uint32_t rx_tail;
+	/// Bytes ever written by the application
+	volatile uint32_t tx_head;
+	/// Bytes ever sent, written by uart0_service() only
+	volatile uint32_t tx_tail;
+	/// Bytes lost due to a full receive ring buffer or FIFO overrun
+	volatile uint32_t rx_dropped;
+	/// True if uart0_service() is called by an interrupt handler
+	int irq;
+} uart0_buffer_t;
+
+
+/// Initialize _buf_ after `uart0_init()`.  If _irq_ is true, FIFO level
+/// interrupts are enabled and an interrupt handler is expected to call
+/// uart0_service().
+static inline void uart0_buffer_init(uart0_buffer_t *buf, int irq)
+{
+	// interrupt when receive FIFO is 1/2 full, or transmit FIFO 1/8 full
+	const struct raspi_UART0_IFLS_reg ifls = {
+		.RXIFLSEL = 2,
+		.TXIFLSEL = 0,
+	};
+
+	buf->rx_head = buf->rx_tail = 0;
+	buf->tx_head = buf->tx_tail = 0;
+	buf->rx_dropped = 0;
+	buf->irq = irq;
+
+	HW.UART0.IMSC.U = 0;
+	HW.UART0.ICR.U = 0x7ff;
+	HW.UART0.IFLS.B = ifls;
+	memory_barrier();
+
+	if (irq) {
+		const struct raspi_UART0_IMSC_reg imsc = {
+			.RXIM = 1,
+			.RTIM = 1,
+			.OEIM = 1,
+		};
+		HW.UART0.IMSC.B = imsc;
+		memory_barrier();
+		HW.IRQ.enable[UART0_IRQ/32] = 1 << (UART0_IRQ%32);
+		memory_barrier();
+	}
+}
+
+
+/// Move received bytes from the FIFO into the receive ring buffer, and pending
+/// bytes from the transmit ring buffer into the FIFO.  Never blocks.
+static inline void uart0_service(uart0_buffer_t *buf)
+{
+	uint32_t head = buf->rx_head;
+	uint32_t tail = buf->tx_tail;
+
+	const struct raspi_UART0_ICR_reg icr = {
+		.OEIC = 1,
+		.BEIC = 1,
+		.PEIC = 1,
+		.FEIC = 1,
+		.RTIC = 1,
+	};
+
+	if (HW.UART0.RIS.B.OERIS) buf->rx_dropped++;
+
+	while (!HW.UART0.FR.B.RXFE) {
+		uint8_t data = HW.UART0.DR.B.DATA;
+		if (head - buf->rx_tail < UART0_BUFSIZE) {
+			buf->rx[head % UART0_BUFSIZE] = data;
+			head++;
+		} else {
+			buf->rx_dropped++;
+		}
+	}
+
+	while (tail != buf->tx_head && !HW.UART0.FR.B.TXFF) {
+		HW.UART0.DR.U = buf->tx[tail % UART0_BUFSIZE];
+		tail++;
+	}
+
+	HW.UART0.ICR.B = icr;
+	if (buf->irq) {
+		struct raspi_UART0_IMSC_reg imsc = {
+			.RXIM = 1,
+			.RTIM = 1,
+			.OEIM = 1,
+		};
+		imsc.TXIM = tail != buf->tx_head;
+		HW.UART0.IMSC.B = imsc;
+	}
+	memory_barrier();
+
+	buf->rx_head = head;
+	buf->tx_tail = tail;
+}
+
+
+/// Return the number of bytes available for uart0_read_buf().
+static inline uint32_t uart0_available(uart0_buffer_t *buf)
+{
+	if (!buf->irq) uart0_service(buf);
+	return buf->rx_head - buf->rx_tail;
+}
+
+
+/// Copy up to _len_ received bytes into _data_ and return the number of bytes
+/// copied.  Never blocks.
+static inline uint32_t uart0_read_buf(uart0_buffer_t *buf, uint8_t *data, uint32_t len)
+{
+	uint32_t tail = buf->rx_tail;
+	uint32_t num = uart0_available(buf);
+	uint32_t i;
+
+	if (num > len) num = len;
+	memory_barrier();
+	for (i = 0; i < num; i++) data[i] = buf->rx[(tail + i) % UART0_BUFSIZE];
+	memory_barrier();
+
+	buf->rx_tail = tail + num;
+	return num;
+}
+
+
+/// Queue up to _len_ bytes from _data_ for sending and return the number of
+/// bytes queued.  Never blocks.
+static inline uint32_t uart0_write_buf(uart0_buffer_t *buf, const uint8_t *data, uint32_t len)
+{
+	uint32_t head = buf->tx_head;
+	uint32_t num = UART0_BUFSIZE - (head - buf->tx_tail);
+	uint32_t i;
+
+	if (num > len) num = len;
+	for (i = 0; i < num; i++) buf->tx[(head + i) % UART0_BUFSIZE] = data[i];
+	memory_barrier();
+	buf->tx_head = head + num;
+
+	// The transmit interrupt only triggers when the FIFO level drops below
+	// the threshold, so the FIFO must be filled here.
+	if (buf->irq) {
+		HW.UART0.IMSC.U = 0;
+		memory_barrier();
+	}
+	uart0_service(buf);
+
+	return num;
+}
+
+
+/// Block until all queued bytes have been sent.
+static inline void uart0_drain(uart0_buffer_t *buf)
+{
+	while (buf->tx_tail != buf->tx_head) {
+		if (!buf->irq) uart0_service(buf);
+	}
+	uart0_flush();
+}
+
+/// @}
+
+
+/**
+ * @name DMA streaming
+ *
+ * Continuous reception into a ring buffer and transmission of a list of
+ * buffers, paced by the UART0 DREQ signals.  The DMA controller always
+ * transfers 32-bit words, so each character occupies one word in DMA memory:
+ * bits 0-7 hold the data, received words contain the error flags of
+ * `HW.UART0.DR` in bits 8-11.  Use uart0_dma_pack() to prepare data for
+ * sending.
+ *
+ * Each control block transfers at most 16384 characters on the DMA "lite"
+ * channels.  Note that the datasheet marks the DMACR register as disabled, so
+ * this may not work on all SoC revisions.
+ *
+ * @{
+ */
+
+/// State of continuous DMA reception.
+typedef struct {
+	/// DMA memory holding the control block and the ring buffer
+	raspi_mem_t *mem;
+	/// Ring buffer size in characters
+	uint32_t num;
+	/// Index of the next character to consume
+	uint32_t tail;
+	/// Number of characters received with framing, parity, break or overrun error
+	uint32_t errors;
+	/// DMA channel
+	int dma;
+} uart0_dma_rx_t;
+
+
+/// One buffer to send via uart0_dma_tx_setup().
+typedef struct {
+	/// Bus address of the characters, one per 32-bit word
+	uint32_t bus;
+	/// Number of characters
+	uint32_t num;
+} uart0_dma_segment_t;
+
+
+/// Size in bytes of the DMA memory required by uart0_dma_rx_start() for a ring
+/// buffer of _num_ characters.
+#define uart0_dma_rx_memsize(num) (sizeof(raspi_dma_control_block) + 4 * (num))
+
+
+/// Size in bytes of the DMA memory required by uart0_dma_tx_setup() for _num_
+/// segments.
+#define uart0_dma_tx_memsize(num) ((num) * sizeof(raspi_dma_control_block))
+
+
+/// Start continuous reception into a ring buffer of _num_ characters in _mem_
+/// on DMA channel _dma_.  Return false if _mem_ is smaller than
+/// `uart0_dma_rx_memsize(num)`.
+static inline int uart0_dma_rx_start(uart0_dma_rx_t *rx, raspi_mem_t *mem, uint32_t num, int dma)
+{
+	volatile raspi_dma_control_block *cb = (volatile raspi_dma_control_block *)mem->virt;
+
+	const struct raspi_DMA_TI_reg ti = {
+		.PERMAP = DMA_PERMAP_UART_RX,
+		.SRC_DREQ = 1,
+		.DEST_INC = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || num > 16384 || mem->size < uart0_dma_rx_memsize(num)) return 0;
+
+	// a single control block pointing to itself forms the ring
+	dma_cb_set(cb, ti, HW_BUS(HW.UART0.DR), MEM_BUS(mem, cb + 1), 4*num, mem->bus);
+
+	rx->mem = mem;
+	rx->num = num;
+	rx->tail = 0;
+	rx->errors = 0;
+	rx->dma = dma;
+
+	dma_reset(dma);
+	dma_start(dma, mem->bus);
+	HW.UART0.DMACR.B.RXDMAE = 1;
+	memory_barrier();
+	return 1;
+}
+
+
+/// Stop continuous reception.
+static inline void uart0_dma_rx_stop(uart0_dma_rx_t *rx)
+{
+	HW.UART0.DMACR.B.RXDMAE = 0;
+	memory_barrier();
+	dma_reset(rx->dma);
+}
+
+
+/// Return the index of the next character to be written by the DMA
+/// controller.
+static inline uint32_t uart0_dma_rx_head(const uart0_dma_rx_t *rx)
+{
+	uint32_t offset = dma_channel(rx->dma)->CB.DEST_AD - (rx->mem->bus + sizeof(raspi_dma_control_block));
+	uint32_t index = offset / 4;
+
+	if (index >= rx->num) index = 0;
+	return index;
+}
+
+
+/// Return the number of characters available for uart0_dma_rx_read().
+static inline uint32_t uart0_dma_rx_available(const uart0_dma_rx_t *rx)
+{
+	return (uart0_dma_rx_head(rx) + rx->num - rx->tail) % rx->num;
+}
+
+
+/// Copy up to _len_ received characters into _data_ and return the number of
+/// characters copied.  Never blocks.
+static inline uint32_t uart0_dma_rx_read(uart0_dma_rx_t *rx, uint8_t *data, uint32_t len)
+{
+	const volatile uint32_t *ring = (const volatile uint32_t *)
+		((volatile raspi_dma_control_block *)rx->mem->virt + 1);
+	uint32_t num = uart0_dma_rx_available(rx);
+	uint32_t i;
+
+	if (num > len) num = len;
+	memory_barrier();
+	for (i = 0; i < num; i++) {
+		uint32_t word = ring[rx->tail];
+		if (word & 0xf00) rx->errors++;
+		data[i] = word;
+		if (++rx->tail == rx->num) rx->tail = 0;
+	}
+
+	return num;
+}
+
+
+/// Convert _num_ characters from _src_ into the format expected by the
+/// transmit DMA, one per 32-bit word in _dest_.
+static inline void uart0_dma_pack(volatile uint32_t *dest, const uint8_t *src, uint32_t num)
+{
+	uint32_t i;
+	for (i = 0; i < num; i++) dest[i] = src[i];
+}
+
+
+/// Prepare control blocks in _cb_ for sending the _num_ segments in _seg_ back
+/// to back.  Return false if _cb_ is smaller than `uart0_dma_tx_memsize(num)`
+/// or a segment is too long.
+static inline int uart0_dma_tx_setup(raspi_mem_t *cb, const uart0_dma_segment_t *seg, uint32_t num)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)cb->virt;
+	uint32_t i;
+
+	const struct raspi_DMA_TI_reg ti = {
+		.PERMAP = DMA_PERMAP_UART_TX,
+		.DEST_DREQ = 1,
+		.SRC_INC = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || cb->size < uart0_dma_tx_memsize(num)) return 0;
+
+	for (i = 0; i < num; i++) {
+		if (!seg[i].num || seg[i].num > 16384) return 0;
+		dma_cb_set(&blocks[i], ti, seg[i].bus, HW_BUS(HW.UART0.DR), 4*seg[i].num,
+				i + 1 < num ? MEM_BUS(cb, &blocks[i + 1]) : 0);
+	}
+
+	return 1;
+}
+
+
+/// Start sending the segments prepared by uart0_dma_tx_setup() in _cb_ on DMA
+/// channel _dma_.  Return immediately.
+static inline void uart0_dma_tx_start(const raspi_mem_t *cb, int dma)
+{
+	dma_reset(dma);
+	HW.UART0.DMACR.B.TXDMAE = 1;
+	memory_barrier();
+	dma_start(dma, cb->bus);
+}
+
+
+/// Return true while a transmission started by uart0_dma_tx_start() is in
+/// progress.  The last characters may still be in the FIFO, see
+/// `uart0_flush()`.
+static inline int uart0_dma_tx_busy(int dma)
+{
+	return dma_busy(dma);
 }
 
+/// @}
 
 #endif
 
@@ -38,11 +38,39 @@
 #include "hw.h"
 #include "mailbox.h"
 
-/// Configure UART hardware for given bit rate.  115200 bit/s is the fastest
-/// speed available.
-static inline void uart1_init(unsigned int bitrate)
+/// Size of both, the receive and the transmit FIFO.
+#define raspi_UART1_FIFOSIZE 8
+
+
+/// Return the value of the BAUD register for _bitrate_ at core clock _clock_.
+static inline uint32_t uart1_baud_divider(uint32_t clock, uint32_t bitrate)
+{
+	uint32_t div = (clock + 4*bitrate) / (8*bitrate);
+	if (div < 1) div = 1;
+	if (div > 65536) div = 65536;
+	return div - 1;
+}
+
+
+/// Return the core clock in Hz, which drives the mini UART.  The cached rate
+/// is used if known, otherwise it is fetched from the firmware.  Fall back to
+/// @ref CORE_CLOCK if the firmware does not report it.
+static inline uint32_t uart1_clock(void)
+{
+	uint32_t rate = mbox_clock_table.rate[MBOX_CLOCK_CORE];
+
+	if (!rate) rate = mbox_clock_update(MBOX_CLOCK_CORE);
+	return rate ? rate : CORE_CLOCK;
+}
+
+
+/// Configure UART hardware for given bit rate, based on the current core
+/// clock.  Return the bit rate actually achieved.  If the core clock changes
+/// later, e.g. due to frequency scaling, use uart1_retune().
+static inline uint32_t uart1_init_bitrate(uint32_t bitrate)
 {
-	const uint32_t UARTCLK = 250000000;
+	const uint32_t UARTCLK = uart1_clock();
+	uint32_t baud = uart1_baud_divider(UARTCLK, bitrate);
 
 	gpio_configure(14, Alt5, PullOff);
 	gpio_configure(15, Alt5, PullOff);
@@ -58,7 +86,7 @@ static inline void uart1_init(unsigned int bitrate)
 	HW.UART1.IER.U = 0; // disable interrupts
 	HW.UART1.LCR.U = 3; // 8-bit mode
 
-	HW.UART1.BAUD = UARTCLK/(8*bitrate)-1; // set bit rate register
+	HW.UART1.BAUD = baud; // set bit rate register
 
 	HW.UART1.IIR.U = 6; // clear FIFOs
 	memory_barrier();
@@ -67,6 +95,33 @@ static inline void uart1_init(unsigned int bitrate)
 	HW.UART1.CNTL.B.RX_ENABLE = 1; // receive/transmit enable
 	memory_barrier();
 
+	return UARTCLK / (8*(baud+1));
+}
+
+
+/// Configure UART hardware for given bit rate.  See uart1_init_bitrate().
+static inline void uart1_init(unsigned int bitrate)
+{
+	uart1_init_bitrate(bitrate);
+}
+
+
+/// Reprogram the bit rate register for _bitrate_ if the core clock differs
+/// from *_clock_, and store the current core clock there.  Call this
+/// periodically or whenever the clock may have changed, ideally while the
+/// transmitter is idle.  Return true if the register was changed.
+static inline int uart1_retune(uint32_t bitrate, uint32_t *clock)
+{
+	uint32_t now = mbox_clock_update(MBOX_CLOCK_CORE);
+
+	if (!now) now = CORE_CLOCK;
+	if (now == *clock) return 0;
+	*clock = now;
+
+	memory_barrier();
+	HW.UART1.BAUD = uart1_baud_divider(now, bitrate);
+	memory_barrier();
+	return 1;
 }
 
 
@@ -103,6 +158,38 @@ static inline void uart1_flush()
 }
 
 
+/// Copy up to _len_ bytes from the receive FIFO into _data_ and return the
+/// number of bytes copied.  Never blocks.  The FIFO fill level is checked once
+/// per batch rather than once per byte.
+static inline uint32_t uart1_read_buf(uint8_t *data, uint32_t len)
+{
+	uint32_t num = 0;
+
+	while (num < len) {
+		uint32_t level = HW.UART1.STAT.B.RX_LEVEL;
+		if (!level) break;
+		if (level > len - num) level = len - num;
+		while (level--) data[num++] = HW.UART1.IO.U;
+	}
+
+	return num;
+}
+
+
+/// Send _len_ bytes from _data_.  Block until all of them are in the transmit
+/// FIFO.  The FIFO fill level is checked once per batch rather than once per
+/// byte.
+static inline void uart1_write_buf(const uint8_t *data, uint32_t len)
+{
+	while (len) {
+		uint32_t space = raspi_UART1_FIFOSIZE - HW.UART1.STAT.B.TX_LEVEL;
+		if (space > len) space = len;
+		len -= space;
+		while (space--) HW.UART1.IO.U = *data++;
+	}
+}
+
+
 #endif
 
 //@}
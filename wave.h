@@ -0,0 +1,257 @@
+/**
+ * @file
+ *
+ * This file contains the whole API as static inline functions, since all
+ * functions are very short.  There is no accompanying C file.
+ *
+ * License
+ * -------
+ *
+ * Copyright (c) 2013-2019 OFFIS e.V.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @defgroup wave GPIO Waveform Generator
+ *
+ * These functions output precisely timed patterns on GPIO0-31 without CPU
+ * involvement.  A waveform is a sequence of @ref wave_step_t, which is
+ * translated into a chain of DMA control blocks writing to `HW.GPIO.SET[0]`
+ * and `HW.GPIO.CLR[0]`.  Delays are generated by writing dummy words into the
+ * FIFO of either the PWM or the PCM peripheral, which consumes exactly one word
+ * per tick.  The selected peripheral cannot be used otherwise meanwhile, and
+ * you *must* unload the respective kernel module.
+ *
+ * The GPIOs must be configured as outputs before starting the waveform.
+ *
+ * Declared in `wave.h`.
+ *
+ * @{
+ */
+
+#ifndef RASPI_DIRECTHW_WAVE_H
+#define RASPI_DIRECTHW_WAVE_H
+
+#include "hw.h"
+#include "dma.h"
+#include "clock.h"
+
+
+/// Peripherals available for pacing the waveform.
+typedef enum {
+	WAVE_PWM,
+	WAVE_PCM
+} wave_pacer_t;
+
+
+/// One step of a waveform.  First, the GPIOs in _set_ are set, then those in
+/// _clear_ are cleared, then the next step follows _delay_ ticks later.
+typedef struct {
+	/// GPIO0-31 to set (to logical high)
+	uint32_t set;
+	/// GPIO0-31 to clear (set to logical low)
+	uint32_t clear;
+	/// Ticks until the next step, at most @ref WAVE_MAX_DELAY
+	uint32_t delay;
+} wave_step_t;
+
+
+/// Frequency in Hz of PLLD, which clocks the pacing peripheral.
+#define WAVE_PLLD_CLOCK CLOCK_PLLD_FREQ
+
+/// Frequency in Hz of the pacing peripheral's clock.
+#define WAVE_CLOCK 10000000
+
+/// Maximum delay of a single step, limited by the DMA "lite" channels.
+#define WAVE_MAX_DELAY 16384
+
+/// Size in bytes of the DMA memory required by wave_setup() for _num_ steps.
+#define wave_memsize(num) ((num) * (3 * sizeof(raspi_dma_control_block) + 8) + 4)
+
+
+/// Stop clock manager entry _cm_, then restart it from PLLD divided by _divi_.
+static inline void wave_clock(raspi_CM_reg_t cm, uint32_t divi)
+{
+	clock_start(cm, CM_PLLD, divi, 0, 0);
+}
+
+
+/// Configure _pacer_ to consume one word via DMA every _tick_us_ µs.  The PCM
+/// peripheral supports ticks of up to 102 µs.  Return false if _tick_us_ is
+/// out of range.
+static inline int wave_pacer_init(wave_pacer_t pacer, uint32_t tick_us)
+{
+	uint32_t ticks = tick_us * (WAVE_CLOCK / ST_1s);
+
+	if (!ticks) return 0;
+
+	if (pacer == WAVE_PWM) {
+		const struct raspi_PWM_CTL_reg clear = {
+			.CLRF1 = 1,
+		};
+
+		const struct raspi_PWM_CTL_reg enable = {
+			.USEF1 = 1,
+			.PWEN1 = 1,
+		};
+
+		const struct raspi_PWM_DMAC_reg dmac = {
+			.ENAB = 1,
+			.PANIC = 1,
+			.DREQ = 1,
+		};
+
+		HW.PWM.CTL.U = 0;
+		memory_barrier();
+		wave_clock(CM_PWM, WAVE_PLLD_CLOCK / WAVE_CLOCK);
+		st_delay(10*ST_1us);
+		memory_barrier();
+
+		HW.PWM.RNG1 = ticks;
+		HW.PWM.DMAC.B = dmac;
+		HW.PWM.CTL.B = clear;
+		st_delay(10*ST_1us);
+		memory_barrier();
+		HW.PWM.CTL.B = enable;
+	} else {
+		const struct raspi_PCM_MODE_reg mode = {
+			.FLEN = ticks - 1,
+			.FSLEN = 1,
+		};
+
+		const struct raspi_PCM_TXC_reg txc = {
+			.CH1EN = 1,
+		};
+
+		const struct raspi_PCM_DREQ_reg dreq = {
+			.TX = 1,
+			.TX_PANIC = 1,
+		};
+
+		const struct raspi_PCM_CS_reg cs = {
+			.EN = 1,
+			.TXCLR = 1,
+			.DMAEN = 1,
+		};
+
+		if (ticks > 1024) return 0;
+
+		HW.PCM.CS.U = 0;
+		memory_barrier();
+		wave_clock(CM_PCM, WAVE_PLLD_CLOCK / WAVE_CLOCK);
+		st_delay(10*ST_1us);
+		memory_barrier();
+
+		HW.PCM.MODE.B = mode;
+		HW.PCM.RXC.U = 0;
+		HW.PCM.TXC.B = txc;
+		HW.PCM.INTEN.U = 0;
+		HW.PCM.DREQ.B = dreq;
+		HW.PCM.CS.B = cs;
+		st_delay(10*ST_1us);
+		HW.PCM.CS.B.TXON = 1;
+	}
+
+	memory_barrier();
+	return 1;
+}
+
+
+/// Stop _pacer_.
+static inline void wave_pacer_stop(wave_pacer_t pacer)
+{
+	if (pacer == WAVE_PWM) {
+		HW.PWM.CTL.U = 0;
+		HW.PWM.DMAC.U = 0;
+	} else {
+		HW.PCM.CS.U = 0;
+	}
+	memory_barrier();
+}
+
+
+/// Prepare control blocks in _mem_ for the _num_ _steps_ of a waveform paced by
+/// _pacer_.  If _loop_ is true, the waveform repeats until stopped.  Return
+/// false if a delay is too long or _mem_ is smaller than `wave_memsize(num)`.
+static inline int wave_setup(raspi_mem_t *mem, wave_pacer_t pacer, const wave_step_t *steps, uint32_t num, int loop)
+{
+	volatile raspi_dma_control_block *blocks = (volatile raspi_dma_control_block *)mem->virt;
+	volatile uint32_t *masks = (volatile uint32_t *)(blocks + 3*num);
+	volatile uint32_t *dummy = masks + 2*num;
+	uint32_t fifo;
+	uint32_t i;
+
+	const struct raspi_DMA_TI_reg ti_gpio = {
+		.WAIT_RESP = 1,
+	};
+
+	const struct raspi_DMA_TI_reg ti_delay = {
+		.PERMAP = pacer == WAVE_PWM ? DMA_PERMAP_PWM : DMA_PERMAP_PCM_TX,
+		.DEST_DREQ = 1,
+		.WAIT_RESP = 1,
+	};
+
+	if (!num || mem->size < wave_memsize(num)) return 0;
+	for (i = 0; i < num; i++) {
+		if (steps[i].delay > WAVE_MAX_DELAY) return 0;
+	}
+
+	fifo = pacer == WAVE_PWM ? HW_BUS(HW.PWM.FIF1) : HW_BUS(HW.PCM.FIFO);
+	*dummy = 0;
+
+	for (i = 0; i < num; i++) {
+		uint32_t next = i + 1 < num ? MEM_BUS(mem, &blocks[3*i + 3]) : loop ? mem->bus : 0;
+
+		masks[2*i] = steps[i].set;
+		masks[2*i + 1] = steps[i].clear;
+
+		dma_cb_set(&blocks[3*i], ti_gpio,
+				MEM_BUS(mem, &masks[2*i]), HW_BUS(HW.GPIO.SET[0]), 4,
+				MEM_BUS(mem, &blocks[3*i + 1]));
+		dma_cb_set(&blocks[3*i + 1], ti_gpio,
+				MEM_BUS(mem, &masks[2*i + 1]), HW_BUS(HW.GPIO.CLR[0]), 4,
+				steps[i].delay ? MEM_BUS(mem, &blocks[3*i + 2]) : next);
+		dma_cb_set(&blocks[3*i + 2], ti_delay,
+				MEM_BUS(mem, dummy), fifo, 4 * steps[i].delay,
+				next);
+	}
+
+	return 1;
+}
+
+
+/// Start the waveform prepared by wave_setup() in _mem_ on DMA channel _dma_.
+/// The pacer must have been initialized with wave_pacer_init().
+static inline void wave_start(const raspi_mem_t *mem, int dma)
+{
+	dma_reset(dma);
+	dma_start(dma, mem->bus);
+}
+
+
+/// Return true while a waveform is being output on DMA channel _dma_.  Looping
+/// waveforms never finish.
+static inline int wave_busy(int dma)
+{
+	return dma_busy(dma);
+}
+
+
+/// Stop the waveform on DMA channel _dma_ immediately.
+static inline void wave_stop(int dma)
+{
+	dma_reset(dma);
+}
+
+#endif
+
+///@}